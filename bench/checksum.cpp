@@ -0,0 +1,194 @@
+// Measures Adler-32 and CRC-32 throughput per implementation variant, over
+// a range of sizes, for aligned and misaligned buffers and for input that is
+// not stored contiguously
+//
+// Usage: bench_checksum [max_size]
+
+#include "mini-adler32.h"
+#include "mini-crc32.h"
+#include "random-data.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+namespace
+{
+    constexpr std::size_t MIN_SIZE = 16;
+    constexpr std::size_t MAX_SIZE = 64 * 1024 * 1024;
+    // Each measurement processes at least this many bytes and runs at least
+    // this long; the clock is read once per batch, so that small sizes are
+    // not dominated by timer overhead
+    constexpr std::size_t MIN_BYTES = 16 * 1024 * 1024;
+    constexpr std::size_t BATCH_BYTES = 4 * 1024 * 1024;
+    constexpr double MIN_SECONDS = 0.1;
+    // Misaligned buffers start this far past a cache line boundary
+    constexpr std::size_t MISALIGNMENT = 1;
+
+    using UpdateFn = std::uint32_t (*)(std::uint32_t value, const std::uint8_t* data, std::size_t length);
+    using UpdateIteratorFn = std::uint32_t (*)(const std::deque<std::uint8_t>& data, std::size_t offset, std::size_t length);
+
+    // Keeps the checksums computed from being optimised away
+    volatile std::uint32_t sink;
+
+    struct Variant
+    {
+        std::string name;
+        UpdateFn fn;
+    };
+
+    struct Algorithm
+    {
+        std::string name;
+        std::uint32_t initial;
+        std::vector<Variant> variants;
+        // Checksums the given non-contiguous bytes through the public interface
+        UpdateIteratorFn updateIterator;
+    };
+
+    std::uint64_t ReadCycles()
+    {
+#if defined(BENCH_HAVE_TSC)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    template<typename Fn>
+    void Measure(const std::string& algorithm, const std::string& variant, std::size_t size, const char* layout, Fn fn)
+    {
+        using Clock = std::chrono::steady_clock;
+        std::size_t iterations = 0;
+        std::uint32_t value = 0;
+        const auto start = Clock::now();
+        const auto start_cycles = ReadCycles();
+        double seconds = 0;
+        const auto batch = std::max<std::size_t>(BATCH_BYTES / size, 1);
+        do {
+            for(std::size_t n = 0; n < batch; n++, iterations++)
+                value ^= fn();
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (seconds < MIN_SECONDS || iterations * size < MIN_BYTES);
+        const auto cycles = ReadCycles() - start_cycles;
+        sink = value;
+
+        const auto bytes = static_cast<double>(iterations) * size;
+        std::printf("%-8s %-10s %-12s %10zu %8.2f", algorithm.c_str(), variant.c_str(), layout, size, bytes / seconds / 1e9);
+        if (cycles != 0)
+            std::printf(" %8.3f\n", static_cast<double>(cycles) / bytes);
+        else
+            std::printf(" %8s\n", "-");
+        std::fflush(stdout);
+    }
+
+    template<typename Fn, typename... Candidates>
+    std::string NameOf(Fn fn, const Candidates&... candidates)
+    {
+        std::string name = "?";
+        ((fn == candidates.second ? (name = candidates.first, 0) : 0), ...);
+        return name;
+    }
+
+    std::vector<Algorithm> MakeAlgorithms()
+    {
+        namespace a = mini_adler32::detail;
+        namespace c = mini_crc32::detail;
+        std::vector<Algorithm> algorithms;
+
+        Algorithm adler{ "adler32", mini_adler32::constants::initial_Adler32, {}, {} };
+        adler.variants.push_back({ "scalar", a::UpdateScalar });
+#if defined(MINI_ADLER32_X86_SIMD)
+        adler.variants.push_back({ "sse2", a::UpdateSSE2 });
+        if (__builtin_cpu_supports("ssse3")) adler.variants.push_back({ "ssse3", a::UpdateSSSE3 });
+        if (__builtin_cpu_supports("avx2")) adler.variants.push_back({ "avx2", a::UpdateAVX2 });
+#endif
+        adler.variants.push_back({ "dispatch", [](std::uint32_t, const std::uint8_t* data, std::size_t length) {
+            mini_adler32::Adler32 adler;
+            adler.Update(data, data + length);
+            return *adler;
+        } });
+        adler.updateIterator = [](const std::deque<std::uint8_t>& data, std::size_t offset, std::size_t length) {
+            mini_adler32::Adler32 adler;
+            adler.Update(data.begin() + offset, data.begin() + offset + length);
+            return *adler;
+        };
+        algorithms.push_back(adler);
+
+        Algorithm crc{ "crc32", mini_crc32::constants::initial_CRC32, {}, {} };
+        crc.variants.push_back({ "bytewise", c::UpdateBytewise });
+        crc.variants.push_back({ "slicing8", c::UpdateSlicing8 });
+#if defined(MINI_CRC32_X86_SIMD)
+        if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) crc.variants.push_back({ "pclmul", c::UpdatePCLMUL });
+#endif
+        crc.variants.push_back({ "dispatch", [](std::uint32_t, const std::uint8_t* data, std::size_t length) {
+            mini_crc32::CRC32 crc;
+            crc.Update(data, data + length);
+            return *crc;
+        } });
+        crc.updateIterator = [](const std::deque<std::uint8_t>& data, std::size_t offset, std::size_t length) {
+            mini_crc32::CRC32 crc;
+            crc.Update(data.begin() + offset, data.begin() + offset + length);
+            return *crc;
+        };
+        algorithms.push_back(crc);
+        return algorithms;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t max_size = MAX_SIZE;
+    if (argc > 1) max_size = std::strtoull(argv[1], nullptr, 0);
+
+    __builtin_cpu_init();
+    using AdlerPair = std::pair<const char*, mini_adler32::detail::UpdateFn>;
+    using CRCPair = std::pair<const char*, mini_crc32::detail::UpdateFn>;
+    std::printf("adler32 dispatch: %s\n", NameOf(mini_adler32::detail::GetUpdateFn(),
+        AdlerPair{ "scalar", mini_adler32::detail::UpdateScalar }
+#if defined(MINI_ADLER32_X86_SIMD)
+        , AdlerPair{ "sse2", mini_adler32::detail::UpdateSSE2 }
+        , AdlerPair{ "ssse3", mini_adler32::detail::UpdateSSSE3 }
+        , AdlerPair{ "avx2", mini_adler32::detail::UpdateAVX2 }
+#endif
+        ).c_str());
+    std::printf("crc32 dispatch: %s\n", NameOf(mini_crc32::detail::GetUpdateFn(),
+        CRCPair{ "slicing8", mini_crc32::detail::UpdateSlicing8 }
+#if defined(MINI_CRC32_X86_SIMD)
+        , CRCPair{ "pclmul", mini_crc32::detail::UpdatePCLMUL }
+#endif
+        ).c_str());
+#if defined(BENCH_HAVE_TSC)
+    std::printf("cycles are reference (TSC) cycles\n");
+#endif
+    std::printf("\n%-8s %-10s %-12s %10s %8s %8s\n", "algo", "variant", "layout", "size", "GB/s", "cyc/B");
+
+    // Cache line aligned, with room for the misaligned start
+    const auto capacity = max_size + 64;
+    std::unique_ptr<std::uint8_t[]> storage(new std::uint8_t[capacity + 64]);
+    auto aligned = reinterpret_cast<std::uint8_t*>((reinterpret_cast<std::uintptr_t>(storage.get()) + 63) & ~std::uintptr_t{63});
+    const auto random = MakeRandomData(capacity, 1);
+    std::copy(random.begin(), random.end(), aligned);
+    const std::deque<std::uint8_t> noncontiguous(aligned, aligned + max_size);
+
+    for(const auto& algorithm: MakeAlgorithms()) {
+        for(std::size_t size = MIN_SIZE; size <= max_size; size *= 4) {
+            for(const auto& variant: algorithm.variants) {
+                Measure(algorithm.name, variant.name, size, "aligned", [&]() { return variant.fn(algorithm.initial, aligned, size); });
+                Measure(algorithm.name, variant.name, size, "misaligned", [&]() { return variant.fn(algorithm.initial, aligned + MISALIGNMENT, size); });
+            }
+            Measure(algorithm.name, "iterator", size, "deque", [&]() { return algorithm.updateIterator(noncontiguous, 0, size); });
+        }
+    }
+    return 0;
+}
@@ -1,7 +1,19 @@
 #pragma once
 
+#include "mini-bytes.h"
+
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <optional>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINI_ADLER32_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
 namespace mini_adler32
 {
@@ -11,6 +23,12 @@ namespace constants
 {
     constexpr inline Value base = 65521;
     constexpr inline Value initial_Adler32 = 1;
+    // Largest number of bytes that can be summed before s2 could overflow
+    // 32 bits, given that s1 and s2 start out below base
+    constexpr inline std::size_t nmax = 5552;
+    constexpr inline std::size_t parallel_ChunkSize = 1024 * 1024;
+    constexpr inline std::size_t chunker_WindowSize = 64;
+    constexpr inline std::size_t chunker_AverageSize = 8192;
 }
 
 template<typename Streamer>
@@ -24,18 +42,199 @@ std::optional<Value> ReadChecksum(Streamer& s)
     return static_cast<Value>(c1 | c2 | c3 | *c4);
 }
 
+namespace detail
+{
+    // Updates an Adler-32 value with a contiguous buffer. All variants sum
+    // up to nmax bytes before reducing modulo the base
+    using UpdateFn = Value (*)(Value value, const std::uint8_t* data, std::size_t length);
+
+    inline Value UpdateScalar(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        std::uint32_t s1 = value & 0xffff;
+        std::uint32_t s2 = (value >> 16) & 0xffff;
+        while(length > 0) {
+            auto n = std::min(length, constants::nmax);
+            length -= n;
+            for(/* nothing */; n >= 4; n -= 4, data += 4) {
+                s1 += data[0]; s2 += s1;
+                s1 += data[1]; s2 += s1;
+                s1 += data[2]; s2 += s1;
+                s1 += data[3]; s2 += s1;
+            }
+            for(/* nothing */; n > 0; n--, data++) {
+                s1 += *data;
+                s2 += s1;
+            }
+            s1 %= constants::base;
+            s2 %= constants::base;
+        }
+        return (s2 << 16) | s1;
+    }
+
+#if defined(MINI_ADLER32_X86_SIMD)
+    // The vector variants process blocks of 32 bytes. Per block, s1 grows by
+    // the sum of the bytes and s2 by 32 times the s1 at the start of the
+    // block plus the bytes weighted 32 down to 1. The s1 values at the
+    // start of each block are summed in ps, and multiplied by 32 at the end
+    constexpr std::size_t SIMD_BLOCK_SIZE = 32;
+    constexpr std::size_t SIMD_MAX_BLOCKS = constants::nmax / SIMD_BLOCK_SIZE;
+
+    __attribute__((target("sse2")))
+    inline std::uint32_t HorizontalSum(__m128i v)
+    {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<std::uint32_t>(_mm_cvtsi128_si32(v));
+    }
+
+    __attribute__((target("sse2")))
+    inline Value UpdateSSE2(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        std::uint32_t s1 = value & 0xffff;
+        std::uint32_t s2 = (value >> 16) & 0xffff;
+        const auto zero = _mm_setzero_si128();
+        const auto weights_1 = _mm_setr_epi16(32, 31, 30, 29, 28, 27, 26, 25);
+        const auto weights_2 = _mm_setr_epi16(24, 23, 22, 21, 20, 19, 18, 17);
+        const auto weights_3 = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+        const auto weights_4 = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+        for(auto blocks = length / SIMD_BLOCK_SIZE; blocks > 0; /* nothing */) {
+            const auto n = std::min(blocks, SIMD_MAX_BLOCKS);
+            blocks -= n;
+            length -= n * SIMD_BLOCK_SIZE;
+            auto v_ps = _mm_cvtsi32_si128(static_cast<int>(s1 * n));
+            auto v_s1 = zero;
+            auto v_s2 = _mm_cvtsi32_si128(static_cast<int>(s2));
+            for(std::size_t b = 0; b < n; b++, data += SIMD_BLOCK_SIZE) {
+                const auto bytes_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                const auto bytes_2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+                v_ps = _mm_add_epi32(v_ps, v_s1);
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes_1, zero));
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes_2, zero));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes_1, zero), weights_1));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes_1, zero), weights_2));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes_2, zero), weights_3));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes_2, zero), weights_4));
+            }
+            v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+            s1 = (s1 + HorizontalSum(v_s1)) % constants::base;
+            s2 = HorizontalSum(v_s2) % constants::base;
+        }
+        return UpdateScalar((s2 << 16) | s1, data, length);
+    }
+
+    __attribute__((target("ssse3")))
+    inline Value UpdateSSSE3(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        std::uint32_t s1 = value & 0xffff;
+        std::uint32_t s2 = (value >> 16) & 0xffff;
+        const auto zero = _mm_setzero_si128();
+        const auto ones = _mm_set1_epi16(1);
+        const auto weights_1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+        const auto weights_2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+        for(auto blocks = length / SIMD_BLOCK_SIZE; blocks > 0; /* nothing */) {
+            const auto n = std::min(blocks, SIMD_MAX_BLOCKS);
+            blocks -= n;
+            length -= n * SIMD_BLOCK_SIZE;
+            auto v_ps = _mm_cvtsi32_si128(static_cast<int>(s1 * n));
+            auto v_s1 = zero;
+            auto v_s2 = _mm_cvtsi32_si128(static_cast<int>(s2));
+            for(std::size_t b = 0; b < n; b++, data += SIMD_BLOCK_SIZE) {
+                const auto bytes_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                const auto bytes_2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+                v_ps = _mm_add_epi32(v_ps, v_s1);
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes_1, zero));
+                v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes_2, zero));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes_1, weights_1), ones));
+                v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes_2, weights_2), ones));
+            }
+            v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+            s1 = (s1 + HorizontalSum(v_s1)) % constants::base;
+            s2 = HorizontalSum(v_s2) % constants::base;
+        }
+        return UpdateScalar((s2 << 16) | s1, data, length);
+    }
+
+    __attribute__((target("avx2")))
+    inline std::uint32_t HorizontalSum(__m256i v)
+    {
+        return HorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    }
+
+    __attribute__((target("avx2")))
+    inline Value UpdateAVX2(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        std::uint32_t s1 = value & 0xffff;
+        std::uint32_t s2 = (value >> 16) & 0xffff;
+        const auto zero = _mm256_setzero_si256();
+        const auto ones = _mm256_set1_epi16(1);
+        const auto weights = _mm256_setr_epi8(
+            32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+            16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+        for(auto blocks = length / SIMD_BLOCK_SIZE; blocks > 0; /* nothing */) {
+            const auto n = std::min(blocks, SIMD_MAX_BLOCKS);
+            blocks -= n;
+            length -= n * SIMD_BLOCK_SIZE;
+            auto v_ps = _mm256_zextsi128_si256(_mm_cvtsi32_si128(static_cast<int>(s1 * n)));
+            auto v_s1 = zero;
+            auto v_s2 = _mm256_zextsi128_si256(_mm_cvtsi32_si128(static_cast<int>(s2)));
+            for(std::size_t b = 0; b < n; b++, data += SIMD_BLOCK_SIZE) {
+                const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+                v_ps = _mm256_add_epi32(v_ps, v_s1);
+                v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+                v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+            }
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+            s1 = (s1 + HorizontalSum(v_s1)) % constants::base;
+            s2 = HorizontalSum(v_s2) % constants::base;
+        }
+        return UpdateScalar((s2 << 16) | s1, data, length);
+    }
+#endif
+
+    // Selects the widest variant the CPU supports
+    inline UpdateFn GetUpdateFn()
+    {
+        static const UpdateFn fn = []() -> UpdateFn {
+#if defined(MINI_ADLER32_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return UpdateAVX2;
+            if (__builtin_cpu_supports("ssse3")) return UpdateSSSE3;
+            if (__builtin_cpu_supports("sse2")) return UpdateSSE2;
+#endif
+            return UpdateScalar;
+        }();
+        return fn;
+    }
+}
+
 struct Adler32
 {
     template<typename Iterator>
     void Update(Iterator it, Iterator endIt)
     {
-        uint32_t s1 = value & 0xffff;
-        uint32_t s2 = (value >> 16) & 0xffff;
-        for (/* nothing */; it != endIt; ++it) {
-            s1 = (s1 + *it) % constants::base;
-            s2 = (s2 + s1) % constants::base;
+        if constexpr (mini_bytes::IsContiguousByteIterator<Iterator>()) {
+            if (it == endIt) return;
+            Update(reinterpret_cast<const std::uint8_t*>(&*it), static_cast<std::size_t>(std::distance(it, endIt)));
+        } else {
+            uint32_t s1 = value & 0xffff;
+            uint32_t s2 = (value >> 16) & 0xffff;
+            std::size_t n = 0;
+            for (/* nothing */; it != endIt; ++it) {
+                s1 += static_cast<std::uint8_t>(*it);
+                s2 += s1;
+                if (++n == constants::nmax) {
+                    s1 %= constants::base;
+                    s2 %= constants::base;
+                    n = 0;
+                }
+            }
+            value = ((s2 % constants::base) << 16) + s1 % constants::base;
         }
-        value = (s2 << 16) + s1;
+    }
+
+    void Update(const std::uint8_t* data, std::size_t length)
+    {
+        value = detail::GetUpdateFn()(value, data, length);
     }
 
     inline Value operator*() const { return value; }
@@ -44,4 +243,195 @@ private:
     Value value{ constants::initial_Adler32 };
 };
 
+// Returns the Adler-32 of the concatenation of two buffers, given the
+// checksum of each and the length of the second
+inline Value Combine(Value a, Value b, std::size_t len_b)
+{
+    const auto base = constants::base;
+    const auto rem = static_cast<std::uint32_t>(len_b % base);
+    const auto a1 = a & 0xffff, a2 = (a >> 16) & 0xffff;
+    const auto b1 = b & 0xffff, b2 = (b >> 16) & 0xffff;
+    // The bytes of b were summed starting from s1 = 1 rather than a1: this
+    // adds a1 - 1 to s1 and rem * (a1 - 1) to s2
+    auto s1 = a1 + b1 + base - 1;
+    auto s2 = static_cast<std::uint32_t>((static_cast<std::uint64_t>(rem) * a1) % base);
+    s2 += a2 + b2 + base - rem;
+    s1 %= base;
+    s2 %= base;
+    return (s2 << 16) | s1;
+}
+
+// Checksums a buffer using multiple threads. The buffer is split in chunks
+// which are summed independently and combined in order
+inline Value ChecksumParallel(const std::uint8_t* data, std::size_t length, unsigned int num_threads = std::thread::hardware_concurrency(), std::size_t chunk_size = constants::parallel_ChunkSize)
+{
+    num_threads = std::max(num_threads, 1u);
+    chunk_size = std::max<std::size_t>(chunk_size, 1);
+    const auto num_chunks = (length + chunk_size - 1) / chunk_size;
+    const auto update = detail::GetUpdateFn();
+    if (num_threads == 1 || num_chunks <= 1)
+        return update(constants::initial_Adler32, data, length);
+
+    // Each thread sums a contiguous range of chunks
+    const auto num_ranges = std::min<std::size_t>(num_threads, num_chunks);
+    std::vector<Value> sums(num_ranges);
+    std::vector<std::size_t> lengths(num_ranges);
+    auto worker = [&](std::size_t range) {
+        const auto start = std::min(length, range * num_chunks / num_ranges * chunk_size);
+        const auto end = std::min(length, (range + 1) * num_chunks / num_ranges * chunk_size);
+        sums[range] = update(constants::initial_Adler32, data + start, end - start);
+        lengths[range] = end - start;
+    };
+
+    std::vector<std::thread> threads;
+    for(std::size_t range = 1; range < num_ranges; range++)
+        threads.emplace_back(worker, range);
+    worker(0);
+    for(auto& t: threads) t.join();
+
+    auto value = sums[0];
+    for(std::size_t range = 1; range < num_ranges; range++)
+        value = Combine(value, sums[range], lengths[range]);
+    return value;
+}
+
+// Adler-32 over the last window_size bytes written, as used by rsync. Each
+// byte written rolls the oldest one out in constant time
+class RollingAdler32
+{
+public:
+    explicit RollingAdler32(std::size_t window_size)
+        : window(std::max<std::size_t>(window_size, 1))
+    {
+    }
+
+    void Update(std::uint8_t in)
+    {
+        auto& slot = window[pos];
+        if (++pos == window.size()) pos = 0;
+        if (filled < window.size()) {
+            filled++;
+            s1 = (s1 + in) % constants::base;
+            s2 = (s2 + s1) % constants::base;
+            slot = in;
+            return;
+        }
+
+        // The oldest byte contributed itself to s1, and window_size times to
+        // s2 (as well as the initial 1)
+        const auto out = slot;
+        slot = in;
+        const auto n = static_cast<std::uint32_t>(window.size() % constants::base);
+        s1 = (s1 + constants::base - out + in) % constants::base;
+        s2 = (s2 + constants::base - n * out % constants::base + s1 + constants::base - 1) % constants::base;
+    }
+
+    template<typename Iterator>
+    void Update(Iterator it, Iterator endIt)
+    {
+        for(/* nothing */; it != endIt; ++it)
+            Update(static_cast<std::uint8_t>(*it));
+    }
+
+    // Whether window_size bytes have been written since construction or the
+    // last Reset()
+    bool Full() const { return filled == window.size(); }
+    std::size_t WindowSize() const { return window.size(); }
+
+    void Reset()
+    {
+        s1 = constants::initial_Adler32;
+        s2 = 0;
+        pos = 0;
+        filled = 0;
+    }
+
+    inline Value operator*() const { return (s2 << 16) | s1; }
+
+private:
+    std::vector<std::uint8_t> window;
+    std::size_t pos{};
+    std::size_t filled{};
+    std::uint32_t s1{ constants::initial_Adler32 };
+    std::uint32_t s2{};
+};
+
+struct ChunkerOptions
+{
+    // Chunks are about average_size bytes on average, at least min_size
+    // and at most max_size. Zero selects average_size / 4 and average_size * 4
+    std::size_t average_size = constants::chunker_AverageSize;
+    std::size_t min_size = 0;
+    std::size_t max_size = 0;
+    std::size_t window_size = constants::chunker_WindowSize;
+};
+
+// Splits data into content-defined chunks: a boundary is placed where the
+// rolling checksum of the preceding bytes matches a pattern, so that
+// inserting or removing bytes only changes the chunks around the edit
+class Chunker
+{
+public:
+    explicit Chunker(const ChunkerOptions& options = {})
+        : adler(options.window_size)
+    {
+        const auto average_size = std::max<std::size_t>(options.average_size, 1);
+        min_size = options.min_size != 0 ? options.min_size : average_size / 4;
+        max_size = options.max_size != 0 ? options.max_size : average_size * 4;
+        max_size = std::max(max_size, std::max<std::size_t>(min_size, 1));
+        // Past min_size, a boundary is found with probability 1 / spread per
+        // byte
+        const auto spread = average_size > min_size ? average_size - min_size : 1;
+        threshold = static_cast<std::uint32_t>(0xffffffffu / std::min<std::size_t>(spread, 0xffffffffu));
+    }
+
+    // Scans data, calling callbackFn(length) for each chunk completed. Chunks
+    // are consecutive and may span several calls
+    template<typename Iterator, typename Callback>
+    void Write(Iterator it, Iterator endIt, Callback callbackFn)
+    {
+        for(/* nothing */; it != endIt; ++it) {
+            adler.Update(static_cast<std::uint8_t>(*it));
+            if (++length < min_size) continue;
+            if (length >= max_size || (adler.Full() && IsBoundary(*adler))) {
+                callbackFn(length);
+                length = 0;
+            }
+        }
+    }
+
+    // Ends the final chunk, if it is not empty, and resets the state
+    template<typename Callback>
+    void Finish(Callback callbackFn)
+    {
+        if (length > 0) callbackFn(length);
+        length = 0;
+        adler.Reset();
+    }
+
+private:
+    bool IsBoundary(Value value) const
+    {
+        // s1 alone is a plain sum of the window; mixing makes the comparison
+        // depend on both halves
+        return static_cast<std::uint32_t>(value * 0x9e3779b1u) < threshold;
+    }
+
+    RollingAdler32 adler;
+    std::size_t min_size{};
+    std::size_t max_size{};
+    std::size_t length{};
+    std::uint32_t threshold{};
+};
+
+// Splits data into content-defined chunks, calling callbackFn(length) for
+// each one in order
+template<typename Data, typename Callback>
+void Chunk(const Data& data, Callback callbackFn, const ChunkerOptions& options = {})
+{
+    Chunker chunker{options};
+    chunker.Write(data.begin(), data.end(), callbackFn);
+    chunker.Finish(callbackFn);
+}
+
 } // namespace mini_adler32
@@ -0,0 +1,38 @@
+#pragma once
+
+// Internal helpers shared by the checksum headers
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace mini_bytes
+{
+
+// Types whose values are single bytes and which may be read as such
+template<typename T>
+constexpr bool IsByte = std::is_same_v<T, char> || std::is_same_v<T, signed char> ||
+    std::is_same_v<T, unsigned char> || std::is_same_v<T, std::byte>;
+
+// Iterators over contiguous bytes, which can be processed as a buffer:
+// pointers (which std::array iterators usually are) and the iterators of
+// std::vector and std::string. Proxy iterators such as those of
+// std::vector<bool> are not, even if bool is a byte in size
+template<typename Iterator>
+constexpr bool IsContiguousByteIterator()
+{
+    using T = std::remove_cv_t<typename std::iterator_traits<Iterator>::value_type>;
+    if constexpr (!IsByte<T>) {
+        return false;
+    } else {
+        return std::is_pointer_v<Iterator> ||
+            std::is_same_v<Iterator, typename std::vector<T>::iterator> ||
+            std::is_same_v<Iterator, typename std::vector<T>::const_iterator> ||
+            std::is_same_v<Iterator, std::string::iterator> ||
+            std::is_same_v<Iterator, std::string::const_iterator>;
+    }
+}
+
+} // namespace mini_bytes
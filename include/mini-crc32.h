@@ -0,0 +1,276 @@
+#pragma once
+
+#include "mini-bytes.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINI_CRC32_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace mini_crc32
+{
+using Value = std::uint32_t;
+
+namespace constants
+{
+    // IEEE 802.3 polynomial, bit-reversed
+    constexpr inline Value polynomial = 0xedb88320;
+    constexpr inline Value initial_CRC32 = 0;
+    constexpr inline std::size_t parallel_ChunkSize = 1024 * 1024;
+}
+
+namespace detail
+{
+    using Table = std::array<std::array<Value, 256>, 8>;
+
+    // tables[0] is the usual byte-at-a-time table; tables[k] advances a
+    // byte's contribution by k further zero bytes
+    constexpr Table MakeTables()
+    {
+        Table tables{};
+        for(Value n = 0; n < 256; n++) {
+            Value c = n;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ constants::polynomial : c >> 1;
+            tables[0][n] = c;
+        }
+        for(std::size_t k = 1; k < tables.size(); k++) {
+            for(std::size_t n = 0; n < 256; n++) {
+                const auto c = tables[k - 1][n];
+                tables[k][n] = (c >> 8) ^ tables[0][c & 0xff];
+            }
+        }
+        return tables;
+    }
+
+    constexpr inline Table tables = MakeTables();
+
+    // Polynomials over GF(2) modulo the CRC polynomial, stored bit-reversed
+    // like the CRC itself: x^0 is the top bit
+    constexpr Value MultiplyModP(Value a, Value b)
+    {
+        Value m = Value{1} << 31;
+        Value p = 0;
+        for(;;) {
+            if (a & m) {
+                p ^= b;
+                if ((a & (m - 1)) == 0) break;
+            }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ constants::polynomial : b >> 1;
+        }
+        return p;
+    }
+
+    // x^(2^k) mod P for k = 0..31
+    constexpr std::array<Value, 32> MakePowerTable()
+    {
+        std::array<Value, 32> table{};
+        Value p = Value{1} << 30;
+        for(auto& t: table) {
+            t = p;
+            p = MultiplyModP(p, p);
+        }
+        return table;
+    }
+
+    constexpr inline std::array<Value, 32> powers = MakePowerTable();
+
+    // x^(8 * length) mod P: the factor by which the CRC of a buffer is
+    // advanced when length bytes follow it
+    constexpr Value ShiftModP(std::size_t length)
+    {
+        Value p = Value{1} << 31;
+        for(std::size_t k = 3; length != 0; length >>= 1, k++) {
+            if (length & 1) p = MultiplyModP(powers[k & 31], p);
+        }
+        return p;
+    }
+
+    // Updates a CRC-32 value with a contiguous buffer. The value passed and
+    // returned is the final, inverted CRC, so calls can be chained
+    using UpdateFn = Value (*)(Value value, const std::uint8_t* data, std::size_t length);
+
+    inline Value UpdateBytewise(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        Value crc = ~value;
+        for(/* nothing */; length > 0; length--, data++)
+            crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xff];
+        return ~crc;
+    }
+
+    inline std::uint32_t Load32(const std::uint8_t* data)
+    {
+        return static_cast<std::uint32_t>(data[0]) | static_cast<std::uint32_t>(data[1]) << 8 |
+            static_cast<std::uint32_t>(data[2]) << 16 | static_cast<std::uint32_t>(data[3]) << 24;
+    }
+
+    // Processes eight bytes per step using a table per byte position
+    inline Value UpdateSlicing8(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        Value crc = ~value;
+        for(/* nothing */; length >= 8; length -= 8, data += 8) {
+            const auto one = Load32(data) ^ crc;
+            const auto two = Load32(data + 4);
+            crc = tables[7][one & 0xff] ^ tables[6][(one >> 8) & 0xff] ^
+                tables[5][(one >> 16) & 0xff] ^ tables[4][one >> 24] ^
+                tables[3][two & 0xff] ^ tables[2][(two >> 8) & 0xff] ^
+                tables[1][(two >> 16) & 0xff] ^ tables[0][two >> 24];
+        }
+        return UpdateBytewise(~crc, data, length);
+    }
+
+#if defined(MINI_CRC32_X86_SIMD)
+    // Folding with carry-less multiplication, after Intel's "Fast CRC
+    // Computation for Generic Polynomials Using PCLMULQDQ Instruction". Four
+    // 128-bit lanes are folded 64 bytes ahead, then into a single lane, then
+    // reduced to 32 bits using Barrett reduction
+    constexpr std::size_t PCLMUL_MIN_LENGTH = 64;
+
+    __attribute__((target("pclmul,sse4.1")))
+    inline __m128i Load128(const std::uint8_t* data)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    }
+
+    __attribute__((target("pclmul,sse4.1")))
+    inline __m128i Fold(__m128i x, __m128i k, __m128i data)
+    {
+        const auto lo = _mm_clmulepi64_si128(x, k, 0x00);
+        const auto hi = _mm_clmulepi64_si128(x, k, 0x11);
+        return _mm_xor_si128(_mm_xor_si128(hi, lo), data);
+    }
+
+    __attribute__((target("pclmul,sse4.1")))
+    inline Value UpdatePCLMUL(Value value, const std::uint8_t* data, std::size_t length)
+    {
+        if (length < PCLMUL_MIN_LENGTH) return UpdateSlicing8(value, data, length);
+
+        const auto k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+        const auto k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+        const auto k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+        const auto poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+        const auto mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+        auto x1 = _mm_xor_si128(Load128(data), _mm_cvtsi32_si128(static_cast<int>(~value)));
+        auto x2 = Load128(data + 16);
+        auto x3 = Load128(data + 32);
+        auto x4 = Load128(data + 48);
+        data += 64;
+        length -= 64;
+        for(/* nothing */; length >= 64; length -= 64, data += 64) {
+            x1 = Fold(x1, k1k2, Load128(data));
+            x2 = Fold(x2, k1k2, Load128(data + 16));
+            x3 = Fold(x3, k1k2, Load128(data + 32));
+            x4 = Fold(x4, k1k2, Load128(data + 48));
+        }
+
+        x1 = Fold(x1, k3k4, x2);
+        x1 = Fold(x1, k3k4, x3);
+        x1 = Fold(x1, k3k4, x4);
+        for(/* nothing */; length >= 16; length -= 16, data += 16)
+            x1 = Fold(x1, k3k4, Load128(data));
+
+        // 128 to 64 bits
+        auto x = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+        x = _mm_xor_si128(_mm_srli_si128(x, 4), _mm_clmulepi64_si128(_mm_and_si128(x, mask32), k5k0, 0x00));
+
+        // Barrett reduction to 32 bits
+        auto t = _mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(x, mask32), poly, 0x10), mask32);
+        t = _mm_clmulepi64_si128(t, poly, 0x00);
+        const auto crc = static_cast<Value>(_mm_extract_epi32(_mm_xor_si128(x, t), 1));
+        return UpdateSlicing8(~crc, data, length);
+    }
+#endif
+
+    // Selects the fastest variant the CPU supports
+    inline UpdateFn GetUpdateFn()
+    {
+        static const UpdateFn fn = []() -> UpdateFn {
+#if defined(MINI_CRC32_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) return UpdatePCLMUL;
+#endif
+            return UpdateSlicing8;
+        }();
+        return fn;
+    }
+}
+
+struct CRC32
+{
+    template<typename Iterator>
+    void Update(Iterator it, Iterator endIt)
+    {
+        if constexpr (mini_bytes::IsContiguousByteIterator<Iterator>()) {
+            if (it == endIt) return;
+            Update(reinterpret_cast<const std::uint8_t*>(&*it), static_cast<std::size_t>(std::distance(it, endIt)));
+        } else {
+            Value crc = ~value;
+            for (/* nothing */; it != endIt; ++it)
+                crc = (crc >> 8) ^ detail::tables[0][(crc ^ static_cast<std::uint8_t>(*it)) & 0xff];
+            value = ~crc;
+        }
+    }
+
+    void Update(const std::uint8_t* data, std::size_t length)
+    {
+        value = detail::GetUpdateFn()(value, data, length);
+    }
+
+    inline Value operator*() const { return value; }
+
+private:
+    Value value{ constants::initial_CRC32 };
+};
+
+// Returns the CRC-32 of the concatenation of two buffers, given the CRC of
+// each and the length of the second, in O(log len_b) time
+constexpr Value Combine(Value a, Value b, std::size_t len_b)
+{
+    return detail::MultiplyModP(detail::ShiftModP(len_b), a) ^ b;
+}
+
+// Checksums a buffer using multiple threads. The buffer is split in chunks
+// which are checksummed independently and combined in order
+inline Value ChecksumParallel(const std::uint8_t* data, std::size_t length, unsigned int num_threads = std::thread::hardware_concurrency(), std::size_t chunk_size = constants::parallel_ChunkSize)
+{
+    num_threads = std::max(num_threads, 1u);
+    chunk_size = std::max<std::size_t>(chunk_size, 1);
+    const auto num_chunks = (length + chunk_size - 1) / chunk_size;
+    const auto update = detail::GetUpdateFn();
+    if (num_threads == 1 || num_chunks <= 1)
+        return update(constants::initial_CRC32, data, length);
+
+    // Each thread checksums a contiguous range of chunks
+    const auto num_ranges = std::min<std::size_t>(num_threads, num_chunks);
+    std::vector<Value> crcs(num_ranges);
+    std::vector<std::size_t> lengths(num_ranges);
+    auto worker = [&](std::size_t range) {
+        const auto start = std::min(length, range * num_chunks / num_ranges * chunk_size);
+        const auto end = std::min(length, (range + 1) * num_chunks / num_ranges * chunk_size);
+        crcs[range] = update(constants::initial_CRC32, data + start, end - start);
+        lengths[range] = end - start;
+    };
+
+    std::vector<std::thread> threads;
+    for(std::size_t range = 1; range < num_ranges; range++)
+        threads.emplace_back(worker, range);
+    worker(0);
+    for(auto& t: threads) t.join();
+
+    auto value = crcs[0];
+    for(std::size_t range = 1; range < num_ranges; range++)
+        value = Combine(value, crcs[range], lengths[range]);
+    return value;
+}
+
+} // namespace mini_crc32
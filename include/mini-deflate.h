@@ -2,9 +2,21 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <optional>
+#include <thread>
 #include <vector>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINI_DEFLATE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace mini_deflate
 {
 
@@ -17,28 +29,52 @@ enum class Result
     EndOfStream,
     InvalidDynamicReference,
     CorruptDistance,
-    InvalidSymbol
+    InvalidSymbol,
+    InvalidLevel,
+    StreamFinished,
+    InvalidMemoryOptions
+};
+
+
+// Input policies for Decompress(). CheckedInput validates every symbol,
+// length and distance and is the only sensible choice for data from an
+// untrusted source. TrustedInput omits the per-symbol validation and is
+// intended for data we produced ourselves and verified by other means;
+// corrupt input yields garbage output, but never reads or writes outside
+// of the input or output buffers.
+struct CheckedInput
+{
+    static constexpr bool validate = true;
 };
 
+struct TrustedInput
+{
+    static constexpr bool validate = false;
+};
 
 namespace detail
 {
     constexpr int MAX_BITS = 15;
+    constexpr std::size_t WINDOW_SIZE = 32768;
     constexpr int SYMBOL_LITERAL_FIRST = 0;
     constexpr int SYMBOL_LITERAL_LAST = 255;
     constexpr int SYMBOL_EOS = 256; // end-of-stream
     constexpr int SYMBOL_REPEAT_FIRST = 257;
     constexpr int SYMBOL_REPEAT_LAST = 285;
 
-    // Byte offsets and number of bits to parse for repeat symbols
-    constexpr std::array repeat_offset_base{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
-    constexpr std::array repeat_extra_bits { 0, 0, 0, 0, 0, 0, 0,  0,  1,  1,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,   4,   5,   5,   5,   5,   0 };
+    // Byte offsets and number of bits to parse for repeat symbols. The
+    // final two entries belong to the invalid symbols 286 and 287; they are
+    // only present so that TrustedInput can index without checking
+    constexpr std::array repeat_offset_base{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0 };
+    constexpr std::array repeat_extra_bits { 0, 0, 0, 0, 0, 0, 0,  0,  1,  1,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,   4,   5,   5,   5,   5,   0, 0, 0 };
     static_assert(repeat_offset_base.size() == repeat_extra_bits.size());
 
-    // Distance base offsets and number of bits to parse
-    constexpr std::array dist_base { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
-    constexpr std::array dist_bits { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    // Distance base offsets and number of bits to parse. As above, the final
+    // two entries are padding for the invalid distance symbols 30 and 31
+    constexpr std::array dist_base { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 1, 1 };
+    constexpr std::array dist_bits { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0 };
     static_assert(dist_base.size() == dist_bits.size());
+    constexpr int NUM_DIST_SYMBOLS = 30;
 
     // Dynamic tree codelength order
     constexpr std::array codelen_order{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
@@ -76,7 +112,7 @@ namespace detail
     Tree BuildCodeTree(Iterator cl_begin, Iterator cl_end)
     {
         // Step 1: count the number of codes for each code length
-        std::array<int, MAX_BITS> bl_count{0};
+        std::array<int, MAX_BITS + 1> bl_count{0};
         int min_bits = MAX_BITS + 1, max_bits = -1;
         std::for_each(cl_begin, cl_end, [&](auto cl) {
             bl_count[cl]++;
@@ -137,13 +173,18 @@ namespace detail
         return fixed_dist_tree;
     }
 
-    template<typename BitStreamer>
+    template<typename Policy = CheckedInput, typename BitStreamer>
     Result GetSymbol(BitStreamer& bs, const Tree& tree, int& symbol)
     {
         int cur_bits = tree.min_bits;
-        const auto hb = bs.GetHuffmanBits(cur_bits);
-        if (!hb.has_value()) return Result::EndOfStream;
-        int cur_code = *hb;
+        int cur_code;
+        if constexpr (Policy::validate) {
+            const auto hb = bs.GetHuffmanBits(cur_bits);
+            if (!hb.has_value()) return Result::EndOfStream;
+            cur_code = *hb;
+        } else {
+            cur_code = bs.GetHuffmanBitsUnchecked(cur_bits);
+        }
         while(true) {
             auto it = std::find_if(tree.begin(), tree.end(), [&](const auto& n) {
                 return n.code == cur_code && n.length == cur_bits;
@@ -152,12 +193,16 @@ namespace detail
                 symbol = it->symbol;
                 return Result::OK;
             }
-            if (cur_bits == tree.max_bits)
+            if (cur_bits >= tree.max_bits)
                 break;
 
-            auto bit = bs.GetBit();
-            if (!bit.has_value()) return Result::EndOfStream;
-            cur_code = (cur_code << 1) | *bit;
+            if constexpr (Policy::validate) {
+                auto bit = bs.GetBit();
+                if (!bit.has_value()) return Result::EndOfStream;
+                cur_code = (cur_code << 1) | *bit;
+            } else {
+                cur_code = (cur_code << 1) | bs.GetDataBitsUnchecked(1);
+            }
             cur_bits++;
         }
 
@@ -212,6 +257,9 @@ namespace detail
                 std::fill_n(std::back_inserter(bl_count), repeat, code);
             }
         }
+        // A repeat must not run past the final code length; otherwise the
+        // trees would contain symbols beyond the ones we have tables for
+        if (bl_count.size() != static_cast<std::size_t>(hlit + hdist)) return Result::InvalidDynamicReference;
 
         // Construct code/distance trees using counts decoded above
         len_tree = BuildCodeTree(bl_count.begin(), bl_count.begin() + hlit);
@@ -219,121 +267,318 @@ namespace detail
         return Result::OK;
     }
 
-    template<typename BitStreamer>
-    Result DecompressBlock(BitStreamer& bs, const Tree& len_tree, const Tree& dist_tree, std::vector<uint8_t>& output)
+    // Decodes a single block, appending it to output. Distances reaching
+    // beyond start, where the block's stream begins in output, refer to the
+    // previous blocks, which are kept in window
+    template<typename Policy, typename BitStreamer>
+    Result DecompressBlock(BitStreamer& bs, const Tree& len_tree, const Tree& dist_tree, const std::vector<uint8_t>& window, std::vector<uint8_t>& output, std::size_t start)
     {
         while(true) {
             int symbol;
-            if(auto result = GetSymbol(bs, len_tree, symbol); result != Result::OK)
+            if constexpr (!Policy::validate) {
+                // Bits past the end of input read as zero; stop once we have
+                // consumed all of them so the output remains bounded
+                if (bs.overrun()) return Result::EndOfStream;
+            }
+            if(auto result = GetSymbol<Policy>(bs, len_tree, symbol); result != Result::OK)
                 return result;
             if (symbol == SYMBOL_EOS) {
+                if constexpr (!Policy::validate) {
+                    // Zero bits may decode as end-of-block in a truncated stream
+                    if (bs.overrun()) return Result::EndOfStream;
+                }
                 break;
             }
 
             if (symbol >= SYMBOL_LITERAL_FIRST && symbol <= SYMBOL_LITERAL_LAST) {
                 output.push_back(static_cast<uint8_t>(symbol - SYMBOL_LITERAL_FIRST));
-            } else if (symbol >= SYMBOL_REPEAT_FIRST && symbol <= SYMBOL_REPEAT_LAST) {
-                const int n = symbol - SYMBOL_REPEAT_FIRST;
-                const int total_length = repeat_offset_base[n] + bs.GetDataBits(repeat_extra_bits[n]).value_or(0);
-                int d_symbol;
-                if (auto result = GetSymbol(bs, dist_tree, d_symbol); result != Result::OK) return result;
-                auto dist = dist_base[d_symbol] + bs.GetDataBits(dist_bits[d_symbol]).value_or(0);
-                if (output.size() < dist) return Result::CorruptDistance;
+                continue;
+            }
+            if constexpr (Policy::validate) {
+                if (symbol > SYMBOL_REPEAT_LAST) return Result::InvalidSymbol;
+            }
 
-                int pos = output.size() - dist;
-                for(int n = 0; n < total_length; n++, pos++) {
-                    output.push_back(output[pos]);
-                }
+            const int n = symbol - SYMBOL_REPEAT_FIRST;
+            int d_symbol;
+            std::size_t total_length, dist;
+            if constexpr (Policy::validate) {
+                total_length = repeat_offset_base[n] + bs.GetDataBits(repeat_extra_bits[n]).value_or(0);
+                if (auto result = GetSymbol(bs, dist_tree, d_symbol); result != Result::OK) return result;
+                if (d_symbol >= NUM_DIST_SYMBOLS) return Result::CorruptDistance;
+                dist = dist_base[d_symbol] + bs.GetDataBits(dist_bits[d_symbol]).value_or(0);
+                if (output.size() - start + window.size() < dist) return Result::CorruptDistance;
             } else {
-                return Result::InvalidSymbol;
+                total_length = repeat_offset_base[n] + bs.GetDataBitsUnchecked(repeat_extra_bits[n]);
+                if (auto result = GetSymbol<Policy>(bs, dist_tree, d_symbol); result != Result::OK) return result;
+                dist = dist_base[d_symbol] + bs.GetDataBitsUnchecked(dist_bits[d_symbol]);
+            }
+
+            // Copy the part that still resides in the window first
+            std::size_t length = total_length;
+            if (dist > output.size() - start) {
+                const auto from_window = std::min(dist - (output.size() - start), length);
+                const auto pos = window.size() - (dist - (output.size() - start));
+                output.insert(output.end(), window.begin() + pos, window.begin() + pos + from_window);
+                length -= from_window;
+            }
+            std::size_t pos = output.size() - dist;
+            for(/* nothing */; length > 0; length--, pos++) {
+                output.push_back(output[pos]);
             }
         }
         return Result::OK;
     }
 
+    // Retains the final WINDOW_SIZE bytes of window + output in window
+    inline void UpdateWindow(std::vector<uint8_t>& window, const std::vector<uint8_t>& output)
+    {
+        if (output.size() >= WINDOW_SIZE) {
+            window.assign(output.end() - WINDOW_SIZE, output.end());
+            return;
+        }
+        const auto keep = std::min(window.size(), WINDOW_SIZE - output.size());
+        window.erase(window.begin(), window.end() - keep);
+        window.insert(window.end(), output.begin(), output.end());
+    }
+
 } // namespace detail
 
+namespace detail
+{
+    // Reads the bits of a deflate stream from a byte source, which provides
+    // Available() and Read(); bytes are only read once their bits are needed
+    template<typename Source>
+    class BitReader
+    {
+    public:
+        explicit BitReader(Source source) : source(source) { }
+
+        bool eof()
+        {
+            return bit_in_buf == 0 && !source.Available();
+        }
+
+        // Whether the unchecked functions have read past the end of the input
+        bool overrun() const
+        {
+            return overrun_bytes > 0;
+        }
+
+        // Bits for the data processed LSB->MSB
+        std::optional<int> GetDataBits(int need)
+        {
+            while(bit_in_buf < need) {
+                if (!source.Available())
+                    return {};
+                bit_buf |= (source.Read() << bit_in_buf);
+                bit_in_buf += 8;
+            }
+
+            int value = bit_buf & ((1 << need) - 1);
+            bit_buf >>= need;
+            bit_in_buf -= need;
+            return value;
+        }
+
+        // As GetDataBits(), but bits past the end of the input read as zero
+        int GetDataBitsUnchecked(int need)
+        {
+            while(bit_in_buf < static_cast<uint32_t>(need)) {
+                if (source.Available())
+                    bit_buf |= (source.Read() << bit_in_buf);
+                else
+                    overrun_bytes++;
+                bit_in_buf += 8;
+            }
+
+            int value = bit_buf & ((1 << need) - 1);
+            bit_buf >>= need;
+            bit_in_buf -= need;
+            return value;
+        }
+
+        auto GetBit()
+        {
+            return GetDataBits(1);
+        }
+
+        // Bits for the Huffmann code lookup are processed MSB->LSB
+        std::optional<int> GetHuffmanBits(int need)
+        {
+            int v = 0;
+            for(int n = 0; n < need; n++) {
+                const auto bit = GetBit();
+                if (!bit.has_value())
+                    return {};
+                v = (v << 1) | *bit;
+            }
+            return v;
+        }
+
+        int GetHuffmanBitsUnchecked(int need)
+        {
+            int v = 0;
+            for(int n = 0; n < need; n++) {
+                v = (v << 1) | GetDataBitsUnchecked(1);
+            }
+            return v;
+        }
+
+        void SkipUntilByteBoundary()
+        {
+            if (bit_in_buf == 0 || bit_in_buf == 8)
+                return;
+
+            for (int n = bit_in_buf; !eof() && n > 0; n--) {
+                GetBit();
+            }
+        }
+
+    protected:
+        void ResetBits()
+        {
+            bit_buf = 0;
+            bit_in_buf = 0;
+            overrun_bytes = 0;
+        }
+
+        Source source;
+
+    private:
+        uint32_t bit_buf = 0;
+        uint32_t bit_in_buf = 0;
+        std::size_t overrun_bytes = 0;
+    };
+
+    // Bytes from a container supporting size() and operator[]
+    template<typename T>
+    struct ContainerSource
+    {
+        bool Available() const { return pos < data.size(); }
+        std::uint8_t Read() { return data[pos++]; }
+
+        const T& data;
+        std::size_t pos = 0;
+    };
+
+    // At most length bytes from a streamer supporting GetByte(). One byte is
+    // looked ahead to know whether another is available
+    template<typename Streamer>
+    struct StreamerSource
+    {
+        bool Available()
+        {
+            if (!next.has_value() && remaining > 0) {
+                next = streamer.GetByte();
+                if (!next.has_value()) {
+                    remaining = 0;
+                    truncated = true;
+                }
+            }
+            return next.has_value();
+        }
+
+        std::uint8_t Read()
+        {
+            const auto byte = *next;
+            next.reset();
+            remaining--;
+            return byte;
+        }
+
+        Streamer& streamer;
+        std::size_t remaining;
+        std::optional<std::uint8_t> next{};
+        bool truncated = false;
+    };
+}
+
+// Reads a deflate stream held in a container
 template<typename T>
-struct BitStreamer
+struct BitStreamer : detail::BitReader<detail::ContainerSource<T>>
 {
-    BitStreamer(const T& data) : data(data) { }
+    BitStreamer(const T& data) : detail::BitReader<detail::ContainerSource<T>>({ data }) { }
 
     void reset()
     {
-        byte_pos = 0;
-        bit_pos = 0;
-        bit_in_buf = 0;
-        bit_buf = 0;
+        this->source.pos = 0;
+        this->ResetBits();
     }
 
-    bool eof() const
+    // Number of bytes read from the container; once a stream is decoded,
+    // whatever follows it starts here
+    std::size_t BytesRead() const
     {
-        return bit_in_buf == 0 && byte_pos == data.size();
+        return this->source.pos;
     }
+};
 
-    // Bits for the data processed LSB->MSB
-    std::optional<int> GetDataBits(int need)
-    {
-        while(bit_in_buf < need) {
-            if (eof())
-                return {};
-            bit_buf |= (data[byte_pos] << bit_in_buf);
-            bit_in_buf += 8;
-            byte_pos++;
-        }
+// A contiguous range of bytes, which a BitStreamer can read without a copy
+struct ByteSpan
+{
+    ByteSpan(const std::uint8_t* bytes, std::size_t length) : bytes(bytes), length(length) { }
 
-        int value = bit_buf & ((1 << need) - 1);
-        bit_buf >>= need;
-        bit_in_buf -= need;
-        return value;
-    }
+    std::size_t size() const { return length; }
+    std::uint8_t operator[](std::size_t n) const { return bytes[n]; }
+    const std::uint8_t* begin() const { return bytes; }
+    const std::uint8_t* end() const { return bytes + length; }
+
+    const std::uint8_t* bytes;
+    std::size_t length;
+};
 
-    auto GetBit()
+// Reads a deflate stream of length bytes from a streamer, taking bytes from
+// it as they are needed rather than requiring the whole stream up front.
+// Bytes past the end of the deflate data are left unread; see Remaining()
+template<typename Streamer>
+struct StreamingBitStreamer : detail::BitReader<detail::StreamerSource<Streamer>>
+{
+    StreamingBitStreamer(Streamer& streamer, std::size_t length)
+        : detail::BitReader<detail::StreamerSource<Streamer>>({ streamer, length })
     {
-        return GetDataBits(1);
     }
 
-    // Bits for the Huffmann code lookup are processed MSB->LSB
-    std::optional<int> GetHuffmanBits(int need)
+    // Number of bytes of the length given that were not taken from the
+    // streamer
+    std::size_t Remaining() const
     {
-        int v = 0;
-        for(int n = 0; n < need; n++) {
-            const auto bit = GetBit();
-            if (!bit.has_value())
-                return {};
-            v = (v << 1) | *bit;
-        }
-        return v;
+        return this->source.remaining - (this->source.next.has_value() ? 1 : 0);
     }
 
-    void SkipUntilByteBoundary()
+    // Whether the streamer ran out before length bytes were read
+    bool Truncated() const
     {
-        if (bit_in_buf == 0 || bit_in_buf == 8)
-            return;
-
-        for (int n = bit_in_buf; !eof() && n > 0; n--) {
-            GetBit();
-        }
+        return this->source.truncated;
     }
-
-private:
-    const T& data;
-    std::size_t byte_pos = 0;
-    std::size_t bit_pos = 0;
-
-    uint32_t bit_buf = 0;
-    uint32_t bit_in_buf = 0;
 };
 
-template<typename BitStreamer, typename Callback>
-Result Decompress(BitStreamer& bs, Callback callbackFn)
+namespace detail
 {
-    while(true)
+    // Back-references may span blocks, so we retain the most recent output.
+    // Trusted input gets a zero-filled window up front, which ensures every
+    // encodable distance stays within bounds without having to check it
+    template<typename Policy, typename Iterator>
+    std::vector<uint8_t> MakeWindow(Iterator it, Iterator endIt)
+    {
+        std::vector<uint8_t> window;
+        if constexpr (!Policy::validate) {
+            window.resize(WINDOW_SIZE, 0);
+        }
+        const auto length = static_cast<std::size_t>(std::distance(it, endIt));
+        if (length > WINDOW_SIZE) std::advance(it, length - WINDOW_SIZE);
+        UpdateWindow(window, std::vector<uint8_t>(it, endIt));
+        return window;
+    }
+
+    // Decodes the next block, appending it to output; see DecompressBlock()
+    template<typename Policy, typename BitStreamer>
+    Result DecompressNextBlock(BitStreamer& bs, const std::vector<uint8_t>& window, std::vector<uint8_t>& output, std::size_t start, bool& final)
     {
         const auto bfinal = bs.GetDataBits(1);
         const auto btype = bs.GetDataBits(2);
         if (!bfinal.has_value() || !btype.has_value())
             return Result::EndOfStream;
+        final = *bfinal != 0;
 
         switch(*btype)
         {
@@ -354,36 +599,1852 @@ Result Decompress(BitStreamer& bs, Callback callbackFn)
                 if ((~*len & 0xffff) != *nlen) {
                     return Result::LengthCorrupt;
                 }
-                std::vector<uint8_t> output;
+                // When appending, reserving here would defeat the vector's growth
+                if (output.empty()) output.reserve(*len);
                 for(int n = *len; n > 0; n--) {
                     const auto c = bs.GetDataBits(8);
                     if (!c.has_value())
                         return Result::EndOfStream;
                     output.push_back(*c);
                 }
-                callbackFn(output);
-                break;
-            }
-            case 1: { // fixed hufmann codes
-                std::vector<uint8_t> output;
-                if (auto result = DecompressBlock(bs, detail::GetFixedLengthTree(), detail::GetFixedDistanceTree(), output); result != Result::OK) return result;
-                callbackFn(output);
-                break;
+                return Result::OK;
             }
+            case 1: // fixed hufmann codes
+                return detail::DecompressBlock<Policy>(bs, detail::GetFixedLengthTree(), detail::GetFixedDistanceTree(), window, output, start);
             case 2: { // dynamic hufmann codes
                 detail::Tree len_tree, dist_tree;
                 if (auto result = detail::ConstructDynamicTrees(bs, len_tree, dist_tree); result != Result::OK)
                     return result;
-                std::vector<uint8_t> output;
-                if (auto result = DecompressBlock(bs, len_tree, dist_tree, output); result != Result::OK) return result;
-                callbackFn(output);
+                return detail::DecompressBlock<Policy>(bs, len_tree, dist_tree, window, output, start);
+            }
+        }
+        return Result::InvalidBlockType;
+    }
+
+    template<typename Policy, typename BitStreamer, typename Callback>
+    Result Decompress(BitStreamer& bs, std::vector<uint8_t> window, Callback callbackFn)
+    {
+        while(true)
+        {
+            std::vector<uint8_t> output;
+            bool final = false;
+            if (auto result = DecompressNextBlock<Policy>(bs, window, output, 0, final); result != Result::OK) return result;
+            callbackFn(output);
+            if (final)
                 break;
+            detail::UpdateWindow(window, output);
+        }
+        return Result::OK;
+    }
+}
+
+template<typename Policy = CheckedInput, typename BitStreamer, typename Callback>
+Result Decompress(BitStreamer& bs, Callback callbackFn)
+{
+    const std::vector<uint8_t> none;
+    return detail::Decompress<Policy>(bs, detail::MakeWindow<Policy>(none.begin(), none.end()), callbackFn);
+}
+
+// As Decompress(), for a stream compressed with a preset dictionary: the
+// dictionary makes up the initial window, so only its last 32 KiB matter
+template<typename Policy = CheckedInput, typename BitStreamer, typename Dictionary, typename Callback>
+Result Decompress(BitStreamer& bs, const Dictionary& dictionary, Callback callbackFn)
+{
+    return detail::Decompress<Policy>(bs, detail::MakeWindow<Policy>(dictionary.begin(), dictionary.end()), callbackFn);
+}
+
+// Decompresses a whole stream by appending it to output, which serves as
+// the window: nothing is copied once decoded, and output never needs to
+// grow if enough of it was reserved beforehand. Distances may not reach
+// into what output held before
+template<typename BitStreamer>
+Result DecompressAppend(BitStreamer& bs, std::vector<uint8_t>& output)
+{
+    const std::vector<uint8_t> none;
+    const auto start = output.size();
+    bool final = false;
+    while(!final) {
+        if (auto result = detail::DecompressNextBlock<CheckedInput>(bs, none, output, start, final); result != Result::OK) return result;
+    }
+    return Result::OK;
+}
+
+namespace constants
+{
+    constexpr inline int level_Store = 0;
+    constexpr inline int level_Fastest = 1;
+    constexpr inline int level_Default = 6;
+    constexpr inline int level_Best = 9;
+    // Optimal parsing; much slower than level_Best, for data that is
+    // compressed once and decompressed many times
+    constexpr inline int level_Max = 10;
+}
+
+enum class Strategy
+{
+    Default,
+    // Speed over ratio: a single hash probe per position, greedy matching
+    // and fixed Huffman codes. The level is ignored
+    Fastest,
+    // For data consisting of small values with a somewhat random
+    // distribution, such as filtered image rows: as Default, but short
+    // matches are discarded in favour of Huffman coded literals
+    Filtered,
+    // Only matches at distance 1, i.e. runs of the same byte. Much faster
+    // than Default and nearly as good on filtered image data. The level is
+    // ignored, except for level_Store
+    Rle,
+    // Literals only; no matching at all. The level is ignored, except for
+    // level_Store
+    HuffmanOnly,
+    // For image data: only matches one pixel back and one row up are tried,
+    // as set by CompressOptions. The level is ignored, except for
+    // level_Store
+    Rows
+};
+
+struct CompressOptions
+{
+    int level{ constants::level_Default };
+    Strategy strategy{ Strategy::Default };
+    // Layout of image data, in bytes: the distance to the same pixel in the
+    // previous row (for PNG, the scanline length plus the filter type byte)
+    // and the size of a pixel. If set, these distances are tried before
+    // the hash chains, which usually finds the best match at once
+    std::size_t row_stride{ 0 };
+    std::size_t pixel_stride{ 0 };
+    // If set, the level is adjusted as input is encoded, so as to approach
+    // this encoding rate in MB/s; the level is where to start. This only
+    // applies to the Default and Fastest strategies
+    double target_mb_per_second{ 0 };
+    // Memory use, as powers of two: the window size in bytes (9-15), the
+    // number of hash table entries (8-16) and the number of hash chain
+    // entries (8 up to window_bits; 0 means window_bits). The amount of
+    // input collected per block scales with the latter. Smaller values
+    // save memory at the cost of ratio; see EncoderMemoryUsage()
+    int window_bits{ 15 };
+    int hash_bits{ 15 };
+    int chain_bits{ 0 };
+};
+
+inline Result ValidateOptions(const CompressOptions& options)
+{
+    if (options.level < constants::level_Store || options.level > constants::level_Max)
+        return Result::InvalidLevel;
+    if (options.window_bits < 9 || options.window_bits > 15 || options.hash_bits < 8 || options.hash_bits > 16)
+        return Result::InvalidMemoryOptions;
+    if (options.chain_bits != 0 && (options.chain_bits < 8 || options.chain_bits > options.window_bits))
+        return Result::InvalidMemoryOptions;
+    return Result::OK;
+}
+
+enum class Flush
+{
+    // Buffer input as needed for the best compression
+    None,
+    // Emit all pending output, followed by an empty stored block so that
+    // the output ends on a byte boundary
+    Sync,
+    // As Sync, but also discard the history; output from this point on can
+    // be decoded without anything that preceded it
+    Full,
+    // Emit all pending output and end the stream
+    Finish
+};
+
+namespace detail
+{
+    constexpr int MIN_MATCH = 3;
+    constexpr int MAX_MATCH = 258;
+    // Amount of data we want available past the current position, so that
+    // a match is never cut short merely because more input is pending
+    constexpr std::size_t MIN_LOOKAHEAD = MAX_MATCH + MIN_MATCH + 1;
+    constexpr std::size_t MAX_STORED_LENGTH = 65535;
+    constexpr int NUM_LITLEN_SYMBOLS = 286;
+    constexpr int NUM_CODELEN_SYMBOLS = 19;
+    constexpr int MAX_CODELEN_BITS = 7;
+    // Length-3 matches further away than this usually cost more than the
+    // literals they replace
+    constexpr int TOO_FAR = 4096;
+    // Longest match the Filtered strategy discards
+    constexpr int FILTERED_TOO_SHORT = 5;
+
+    // Match finder parameters per compression level; these are the values
+    // zlib uses
+    struct LevelConfig
+    {
+        int good_length; // reduce chain search above this match length
+        int max_lazy; // do not attempt lazy matching above this length
+        int nice_length; // stop searching once we found a match this long
+        int max_chain; // maximum number of hash chain entries to examine
+        bool lazy; // whether to use lazy matching
+    };
+
+    constexpr std::array<LevelConfig, 11> level_configs{ {
+        {  0,   0,   0,    0, false }, // 0: store only
+        {  4,   4,   8,    4, false }, // 1
+        {  4,   5,  16,    8, false }, // 2
+        {  4,   6,  32,   32, false }, // 3
+        {  4,   4,  16,   16, true  }, // 4
+        {  8,  16,  32,   32, true  }, // 5
+        {  8,  16, 128,  128, true  }, // 6
+        {  8,  32, 128,  256, true  }, // 7
+        { 32, 128, 258, 1024, true  }, // 8
+        { 32, 258, 258, 4096, true  }, // 9
+        { 32, 258, 258, 8192, true  }  // 10: optimal parsing
+    } };
+
+    // A literal (distance == 0) or a length/distance pair
+    struct Token
+    {
+        std::uint16_t value;
+        std::uint16_t distance;
+    };
+
+    // Huffman code with its bits reversed, so it can be written LSB->MSB
+    struct Code
+    {
+        std::uint16_t bits = 0;
+        std::uint16_t length = 0;
+    };
+
+    // Maps match lengths to their index in repeat_offset_base
+    constexpr auto length_symbol_table = []{
+        std::array<std::uint8_t, MAX_MATCH + 1> t{};
+        for(std::size_t n = 0; n < repeat_offset_base.size() - 2; n++) {
+            const int first = repeat_offset_base[n];
+            const int last = std::min(first + (1 << repeat_extra_bits[n]) - 1, MAX_MATCH);
+            for(int l = first; l <= last; l++) t[l] = n;
+        }
+        return t;
+    }();
+
+    // Maps distances to their symbol. Distances up to 256 are looked up
+    // directly; beyond that, the symbol only depends on the bits above the
+    // 7th
+    constexpr auto distance_symbol_table = []{
+        std::array<std::uint8_t, 512> t{};
+        for(int n = 0; n < NUM_DIST_SYMBOLS; n++) {
+            const int first = dist_base[n];
+            const int last = first + (1 << dist_bits[n]) - 1;
+            for(int d = first; d <= last; d++) {
+                if (d <= 256) t[d - 1] = n;
+                else t[256 + ((d - 1) >> 7)] = n;
+            }
+        }
+        return t;
+    }();
+
+    inline int LengthSymbolIndex(int length)
+    {
+        return length_symbol_table[length];
+    }
+
+    inline int DistanceSymbol(int distance)
+    {
+        return distance <= 256 ? distance_symbol_table[distance - 1] : distance_symbol_table[256 + ((distance - 1) >> 7)];
+    }
+
+    inline std::uint16_t ReverseBits(int code, int length)
+    {
+        int result = 0;
+        for(int n = 0; n < length; n++, code >>= 1)
+            result = (result << 1) | (code & 1);
+        return static_cast<std::uint16_t>(result);
+    }
+
+    template<typename Lengths>
+    std::vector<Code> BuildEncoderCodes(const Lengths& lengths)
+    {
+        const auto tree = BuildCodeTree(lengths.begin(), lengths.end());
+        std::vector<Code> codes(tree.nodes.size());
+        for(std::size_t n = 0; n < codes.size(); n++) {
+            codes[n].length = tree[n].length;
+            codes[n].bits = ReverseBits(tree[n].code, tree[n].length);
+        }
+        return codes;
+    }
+
+    inline const std::vector<int>& GetFixedLengthCodeLengths()
+    {
+        static const auto lengths = []{
+            std::vector<int> l(288);
+            for(int n = 0; n < 288; n++) l[n] = GetFixedLengthTree()[n].length;
+            return l;
+        }();
+        return lengths;
+    }
+
+    inline const std::vector<Code>& GetFixedLengthCodes()
+    {
+        static const auto codes = BuildEncoderCodes(GetFixedLengthCodeLengths());
+        return codes;
+    }
+
+    inline const std::vector<Code>& GetFixedDistanceCodes()
+    {
+        static const auto codes = BuildEncoderCodes(std::vector<int>(NUM_DIST_SYMBOLS, 5));
+        return codes;
+    }
+
+    // Computes optimal Huffman code lengths for the given symbol frequencies,
+    // such that no code exceeds max_bits. If the plain Huffman code is too
+    // deep, this uses the package-merge algorithm: every level pairs up the
+    // items of the previous level into packages and merges these with the
+    // leaves, and the first 2n - 2 items of the final level determine how
+    // often each leaf occurs in the tree
+    inline std::vector<int> BuildHuffmanLengths(const std::vector<std::uint32_t>& freqs, int max_bits)
+    {
+        std::vector<int> lengths(freqs.size(), 0);
+        std::vector<std::pair<std::uint32_t, int>> leaves;
+        for(std::size_t n = 0; n < freqs.size(); n++) {
+            if (freqs[n] != 0) leaves.emplace_back(freqs[n], n);
+        }
+        if (leaves.empty()) return lengths;
+        if (leaves.size() == 1) {
+            lengths[leaves.front().second] = 1;
+            return lengths;
+        }
+        std::sort(leaves.begin(), leaves.end());
+        const std::size_t num_leaves = leaves.size();
+        const std::size_t num_items = 2 * num_leaves - 2;
+
+        // Usually an unrestricted Huffman code already fits, in which case it
+        // is optimal as well. It is built with two queues: the sorted leaves
+        // and the internal nodes, which are created in order of weight
+        {
+            std::vector<std::uint64_t> weight(num_items + 1);
+            std::vector<int> parent(num_items + 1);
+            for(std::size_t n = 0; n < num_leaves; n++) weight[n] = leaves[n].first;
+            std::size_t next_leaf = 0, next_node = num_leaves;
+            auto takeSmallest = [&](std::size_t node) {
+                const auto n = next_leaf < num_leaves && (next_node == node || weight[next_leaf] <= weight[next_node]) ? next_leaf++ : next_node++;
+                parent[n] = node;
+                return weight[n];
+            };
+            for(std::size_t node = num_leaves; node <= num_items; node++)
+                weight[node] = takeSmallest(node) + takeSmallest(node);
+
+            // Nodes are created after their children, so depths can be
+            // assigned from the root down
+            std::vector<int> depth(num_items + 1, 0);
+            for(std::size_t n = num_items; n-- > 0; /* nothing */)
+                depth[n] = depth[parent[n]] + 1;
+            if (*std::max_element(depth.begin(), depth.begin() + num_leaves) <= max_bits) {
+                for(std::size_t n = 0; n < num_leaves; n++) lengths[leaves[n].second] = depth[n];
+                return lengths;
+            }
+        }
+
+        // Nodes below num_leaves are leaves, the remainder are packages
+        struct Node
+        {
+            std::uint64_t weight;
+            int left, right;
+        };
+        std::vector<Node> nodes;
+        nodes.reserve(num_leaves + max_bits * num_items);
+        for(const auto& leaf: leaves) nodes.push_back(Node{ leaf.first, -1, -1 });
+
+        std::vector<int> list(num_leaves);
+        for(std::size_t n = 0; n < num_leaves; n++) list[n] = n;
+        std::vector<int> merged;
+        for(int level = 1; level < max_bits; level++) {
+            merged.clear();
+            std::size_t next_leaf = 0, next_pair = 0;
+            const std::size_t num_pairs = list.size() / 2;
+            while(merged.size() < num_items && (next_leaf < num_leaves || next_pair < num_pairs)) {
+                std::uint64_t package_weight = 0;
+                if (next_pair < num_pairs)
+                    package_weight = nodes[list[2 * next_pair]].weight + nodes[list[2 * next_pair + 1]].weight;
+                if (next_leaf < num_leaves && (next_pair == num_pairs || nodes[next_leaf].weight <= package_weight)) {
+                    merged.push_back(next_leaf++);
+                } else {
+                    nodes.push_back(Node{ package_weight, list[2 * next_pair], list[2 * next_pair + 1] });
+                    merged.push_back(nodes.size() - 1);
+                    next_pair++;
+                }
+            }
+            std::swap(list, merged);
+        }
+
+        std::vector<int> pending(list.begin(), list.begin() + std::min(num_items, list.size()));
+        while(!pending.empty()) {
+            const auto n = pending.back();
+            pending.pop_back();
+            if (n < static_cast<int>(num_leaves)) {
+                lengths[leaves[n].second]++;
+            } else {
+                pending.push_back(nodes[n].left);
+                pending.push_back(nodes[n].right);
+            }
+        }
+        return lengths;
+    }
+
+    struct BitWriter
+    {
+        // Bits are written LSB->MSB; count must not exceed 32
+        void PutBits(std::uint32_t value, int count)
+        {
+            bit_buf |= static_cast<std::uint64_t>(value) << bit_count;
+            bit_count += count;
+            if (bit_count >= 32) {
+                const auto size = data.size();
+                data.resize(size + 4);
+                for(int n = 0; n < 4; n++, bit_buf >>= 8)
+                    data[size + n] = static_cast<std::uint8_t>(bit_buf);
+                bit_count -= 32;
+            }
+        }
+
+        void PutCode(const Code& code)
+        {
+            PutBits(code.bits, code.length);
+        }
+
+        // Pads to a byte boundary and moves all pending bits to data
+        void AlignToByte()
+        {
+            for(/* nothing */; bit_count > 0; bit_count -= std::min(bit_count, 8), bit_buf >>= 8)
+                data.push_back(static_cast<std::uint8_t>(bit_buf));
+        }
+
+        // Moves all complete bytes to data
+        void FlushBytes()
+        {
+            for(/* nothing */; bit_count >= 8; bit_count -= 8, bit_buf >>= 8)
+                data.push_back(static_cast<std::uint8_t>(bit_buf));
+        }
+
+        // Number of bits written in total
+        std::uint64_t BitCount() const
+        {
+            return data.size() * 8 + bit_count;
+        }
+
+        std::vector<std::uint8_t> data;
+        std::uint64_t bit_buf = 0;
+        int bit_count = 0;
+    };
+
+    using TokenIterator = std::vector<Token>::const_iterator;
+
+    struct BlockStatistics
+    {
+        std::vector<std::uint32_t> lit_freqs = std::vector<std::uint32_t>(NUM_LITLEN_SYMBOLS, 0);
+        std::vector<std::uint32_t> dist_freqs = std::vector<std::uint32_t>(NUM_DIST_SYMBOLS, 0);
+
+        void Add(const Token& token)
+        {
+            if (token.distance == 0) {
+                lit_freqs[token.value]++;
+            } else {
+                lit_freqs[SYMBOL_REPEAT_FIRST + LengthSymbolIndex(token.value)]++;
+                dist_freqs[DistanceSymbol(token.distance)]++;
             }
-            case 3: // reserved
-                return Result::InvalidBlockType;
         }
-        if (bfinal)
-            break;
+    };
+
+    inline BlockStatistics GatherStatistics(TokenIterator begin, TokenIterator end)
+    {
+        BlockStatistics stats;
+        std::for_each(begin, end, [&](const auto& token) { stats.Add(token); });
+        stats.lit_freqs[SYMBOL_EOS]++;
+        return stats;
+    }
+
+    // Bits needed to encode the tokens using the given code lengths
+    inline std::uint64_t TokenCost(const BlockStatistics& stats, const std::vector<int>& lit_lengths, const std::vector<int>& dist_lengths)
+    {
+        std::uint64_t bits = 0;
+        for(std::size_t n = 0; n < stats.lit_freqs.size(); n++) {
+            bits += static_cast<std::uint64_t>(stats.lit_freqs[n]) * lit_lengths[n];
+            if (n >= SYMBOL_REPEAT_FIRST)
+                bits += static_cast<std::uint64_t>(stats.lit_freqs[n]) * repeat_extra_bits[n - SYMBOL_REPEAT_FIRST];
+        }
+        for(std::size_t n = 0; n < stats.dist_freqs.size(); n++) {
+            bits += static_cast<std::uint64_t>(stats.dist_freqs[n]) * (dist_lengths[n] + dist_bits[n]);
+        }
+        return bits;
+    }
+
+    // Stored blocks are byte aligned and carry 32 bits of length for every
+    // 64KiB of data
+    inline std::uint64_t StoredCost(std::size_t length)
+    {
+        return 8 * (length + 4 * (length / MAX_STORED_LENGTH + 1)) + 7;
+    }
+
+    // Symbol of the code length alphabet; 16, 17 and 18 carry a repeat count
+    // in their extra bits
+    struct CodeLengthSymbol
+    {
+        std::uint8_t symbol;
+        std::uint8_t extra;
+    };
+
+    constexpr std::array<int, NUM_CODELEN_SYMBOLS> codelen_extra_bits{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+
+    // Run-length encodes a code length sequence as per 3.2.7
+    inline std::vector<CodeLengthSymbol> EncodeCodeLengths(const std::vector<int>& lengths)
+    {
+        std::vector<CodeLengthSymbol> symbols;
+        for(std::size_t n = 0; n < lengths.size(); /* nothing */) {
+            const auto value = lengths[n];
+            std::size_t run = 1;
+            while(n + run < lengths.size() && lengths[n + run] == value) run++;
+            n += run;
+
+            if (value == 0) {
+                for(/* nothing */; run >= 11; run -= std::min<std::size_t>(run, 138))
+                    symbols.push_back({ 18, static_cast<std::uint8_t>(std::min<std::size_t>(run, 138) - 11) });
+                if (run >= 3) {
+                    symbols.push_back({ 17, static_cast<std::uint8_t>(run - 3) });
+                    run = 0;
+                }
+            } else {
+                symbols.push_back({ static_cast<std::uint8_t>(value), 0 });
+                for(run--; run >= 3; run -= std::min<std::size_t>(run, 6))
+                    symbols.push_back({ 16, static_cast<std::uint8_t>(std::min<std::size_t>(run, 6) - 3) });
+            }
+            for(/* nothing */; run > 0; run--)
+                symbols.push_back({ static_cast<std::uint8_t>(value), 0 });
+        }
+        return symbols;
+    }
+
+    struct DynamicHeader
+    {
+        int hlit = 0;
+        int hdist = 0;
+        int hclen = 0;
+        std::vector<CodeLengthSymbol> symbols;
+        std::vector<int> codelen_lengths;
+
+        std::uint64_t Cost() const
+        {
+            std::uint64_t bits = 5 + 5 + 4 + 3 * hclen;
+            for(const auto& s: symbols) bits += codelen_lengths[s.symbol] + codelen_extra_bits[s.symbol];
+            return bits;
+        }
+    };
+
+    inline DynamicHeader BuildDynamicHeader(const std::vector<int>& lit_lengths, const std::vector<int>& dist_lengths)
+    {
+        DynamicHeader header;
+        header.hlit = NUM_LITLEN_SYMBOLS;
+        while(header.hlit > SYMBOL_REPEAT_FIRST && lit_lengths[header.hlit - 1] == 0) header.hlit--;
+        header.hdist = NUM_DIST_SYMBOLS;
+        while(header.hdist > 1 && dist_lengths[header.hdist - 1] == 0) header.hdist--;
+
+        // Literal/length and distance code lengths form a single sequence,
+        // so runs may cross from one into the other
+        std::vector<int> lengths(lit_lengths.begin(), lit_lengths.begin() + header.hlit);
+        lengths.insert(lengths.end(), dist_lengths.begin(), dist_lengths.begin() + header.hdist);
+        header.symbols = EncodeCodeLengths(lengths);
+
+        std::vector<std::uint32_t> freqs(NUM_CODELEN_SYMBOLS, 0);
+        for(const auto& s: header.symbols) freqs[s.symbol]++;
+        // A code length code with a single symbol would be incomplete
+        if (std::count_if(freqs.begin(), freqs.end(), [](auto f) { return f != 0; }) < 2)
+            freqs[freqs[0] == 0 ? 0 : 1]++;
+        header.codelen_lengths = BuildHuffmanLengths(freqs, MAX_CODELEN_BITS);
+
+        header.hclen = NUM_CODELEN_SYMBOLS;
+        while(header.hclen > 4 && header.codelen_lengths[codelen_order[header.hclen - 1]] == 0) header.hclen--;
+        return header;
+    }
+
+    inline void WriteDynamicHeader(BitWriter& writer, const DynamicHeader& header)
+    {
+        writer.PutBits(header.hlit - 257, 5);
+        writer.PutBits(header.hdist - 1, 5);
+        writer.PutBits(header.hclen - 4, 4);
+        for(int n = 0; n < header.hclen; n++)
+            writer.PutBits(header.codelen_lengths[codelen_order[n]], 3);
+        const auto codes = BuildEncoderCodes(header.codelen_lengths);
+        for(const auto& s: header.symbols) {
+            writer.PutCode(codes[s.symbol]);
+            writer.PutBits(s.extra, codelen_extra_bits[s.symbol]);
+        }
+    }
+
+    inline void WriteTokens(BitWriter& writer, TokenIterator begin, TokenIterator end, const std::vector<Code>& lit_codes, const std::vector<Code>& dist_codes)
+    {
+        for(/* nothing */; begin != end; ++begin) {
+            const auto& token = *begin;
+            if (token.distance == 0) {
+                writer.PutCode(lit_codes[token.value]);
+                continue;
+            }
+            const int l = LengthSymbolIndex(token.value);
+            writer.PutCode(lit_codes[SYMBOL_REPEAT_FIRST + l]);
+            writer.PutBits(token.value - repeat_offset_base[l], repeat_extra_bits[l]);
+            const int d = DistanceSymbol(token.distance);
+            writer.PutCode(dist_codes[d]);
+            writer.PutBits(token.distance - dist_base[d], dist_bits[d]);
+        }
+        writer.PutCode(lit_codes[SYMBOL_EOS]);
+    }
+
+    inline void WriteStoredBlocks(BitWriter& writer, const std::uint8_t* data, std::size_t length, bool final)
+    {
+        do {
+            const auto chunk = std::min(length, MAX_STORED_LENGTH);
+            const bool last = chunk == length;
+            writer.PutBits(final && last ? 1 : 0, 1);
+            writer.PutBits(0, 2);
+            writer.AlignToByte();
+            writer.PutBits(chunk, 16);
+            writer.PutBits(~chunk & 0xffff, 16);
+            writer.data.insert(writer.data.end(), data, data + chunk);
+            data += chunk;
+            length -= chunk;
+        } while(length > 0);
+    }
+
+    enum class BlockType
+    {
+        Stored,
+        Fixed,
+        Dynamic
+    };
+
+    // The cheapest representation of a block, along with its size in bits
+    struct BlockPlan
+    {
+        BlockType type;
+        std::uint64_t cost;
+        std::vector<int> lit_lengths;
+        std::vector<int> dist_lengths;
+        DynamicHeader header;
+    };
+
+    inline BlockPlan PlanBlock(const BlockStatistics& stats, std::size_t length)
+    {
+        BlockPlan plan;
+        plan.lit_lengths = BuildHuffmanLengths(stats.lit_freqs, MAX_BITS);
+        plan.dist_lengths = BuildHuffmanLengths(stats.dist_freqs, MAX_BITS);
+        plan.header = BuildDynamicHeader(plan.lit_lengths, plan.dist_lengths);
+        const auto dynamic_cost = 3 + plan.header.Cost() + TokenCost(stats, plan.lit_lengths, plan.dist_lengths);
+        const auto fixed_cost = 3 + TokenCost(stats, GetFixedLengthCodeLengths(), std::vector<int>(NUM_DIST_SYMBOLS, 5));
+        const auto stored_cost = StoredCost(length);
+
+        if (stored_cost <= std::min(fixed_cost, dynamic_cost)) {
+            plan.type = BlockType::Stored;
+            plan.cost = stored_cost;
+        } else if (fixed_cost <= dynamic_cost) {
+            plan.type = BlockType::Fixed;
+            plan.cost = fixed_cost;
+        } else {
+            plan.type = BlockType::Dynamic;
+            plan.cost = dynamic_cost;
+        }
+        return plan;
+    }
+
+    inline void WritePlannedBlock(BitWriter& writer, const BlockPlan& plan, TokenIterator begin, TokenIterator end, const std::uint8_t* data, std::size_t length, bool final)
+    {
+        switch(plan.type) {
+            case BlockType::Stored:
+                WriteStoredBlocks(writer, data, length, final);
+                break;
+            case BlockType::Fixed:
+                writer.PutBits(final ? 1 : 0, 1);
+                writer.PutBits(1, 2);
+                WriteTokens(writer, begin, end, GetFixedLengthCodes(), GetFixedDistanceCodes());
+                break;
+            case BlockType::Dynamic:
+                writer.PutBits(final ? 1 : 0, 1);
+                writer.PutBits(2, 2);
+                WriteDynamicHeader(writer, plan.header);
+                WriteTokens(writer, begin, end, BuildEncoderCodes(plan.lit_lengths), BuildEncoderCodes(plan.dist_lengths));
+                break;
+        }
+    }
+
+    // Estimates the number of bits for the symbols in freqs by their entropy
+    inline double EstimateBits(const std::vector<std::uint32_t>& freqs)
+    {
+        double total = 0;
+        for(auto f: freqs) total += f;
+        double bits = 0;
+        for(auto f: freqs) {
+            if (f != 0) bits += f * std::log2(total / f);
+        }
+        return bits;
+    }
+
+    inline double EstimateCost(const BlockStatistics& stats)
+    {
+        return EstimateBits(stats.lit_freqs) + EstimateBits(stats.dist_freqs);
+    }
+
+    constexpr std::size_t MIN_SPLIT_TOKENS = 256;
+    constexpr int MAX_SPLIT_DEPTH = 4;
+
+    // Writes tokens as one or more blocks. Where the symbol statistics change
+    // within the tokens, separate blocks with their own trees are cheaper;
+    // we look for the split point with the lowest estimated cost and
+    // recurse into both halves if it beats a single block
+    inline void WriteBlocks(BitWriter& writer, TokenIterator begin, TokenIterator end, const std::uint8_t* data, std::size_t length, bool final, int depth = 0)
+    {
+        const auto stats = GatherStatistics(begin, end);
+        const auto plan = PlanBlock(stats, length);
+        const auto num_tokens = static_cast<std::size_t>(std::distance(begin, end));
+        if (depth < MAX_SPLIT_DEPTH && num_tokens >= 2 * MIN_SPLIT_TOKENS && plan.type != BlockType::Stored) {
+            const auto step = std::max(MIN_SPLIT_TOKENS, num_tokens / 32);
+            BlockStatistics left, right;
+            std::size_t left_length = 0;
+            std::size_t best_split = 0, best_length = 0;
+            double best_estimate = EstimateCost(stats);
+            auto it = begin;
+            for(std::size_t n = 0; n + step < num_tokens; /* nothing */) {
+                for(std::size_t m = 0; m < step; m++, n++, ++it) {
+                    left.Add(*it);
+                    left_length += it->distance == 0 ? 1 : it->value;
+                }
+                for(std::size_t s = 0; s < NUM_LITLEN_SYMBOLS; s++) right.lit_freqs[s] = stats.lit_freqs[s] - left.lit_freqs[s];
+                for(std::size_t s = 0; s < NUM_DIST_SYMBOLS; s++) right.dist_freqs[s] = stats.dist_freqs[s] - left.dist_freqs[s];
+                const auto estimate = EstimateCost(left) + EstimateCost(right);
+                if (estimate < best_estimate) {
+                    best_estimate = estimate;
+                    best_split = n;
+                    best_length = left_length;
+                }
+            }
+
+            if (best_split != 0) {
+                const auto split = begin + best_split;
+                const auto left_plan = PlanBlock(GatherStatistics(begin, split), best_length);
+                const auto right_plan = PlanBlock(GatherStatistics(split, end), length - best_length);
+                if (left_plan.cost + right_plan.cost < plan.cost) {
+                    WriteBlocks(writer, begin, split, data, best_length, false, depth + 1);
+                    WriteBlocks(writer, split, end, data + best_length, length - best_length, final, depth + 1);
+                    return;
+                }
+            }
+        }
+        WritePlannedBlock(writer, plan, begin, end, data, length, final);
+    }
+
+    // Writes a fixed Huffman block, unless a stored block would be smaller.
+    // This avoids the cost of gathering statistics and building trees
+    inline void WriteFixedBlock(BitWriter& writer, const std::vector<Token>& tokens, const std::uint8_t* data, std::size_t length, bool final)
+    {
+        const auto& lit_codes = GetFixedLengthCodes();
+        std::uint64_t fixed_cost = 3 + lit_codes[SYMBOL_EOS].length;
+        for(const auto& token: tokens) {
+            if (token.distance == 0) {
+                fixed_cost += lit_codes[token.value].length;
+            } else {
+                const int l = LengthSymbolIndex(token.value);
+                fixed_cost += lit_codes[SYMBOL_REPEAT_FIRST + l].length + repeat_extra_bits[l] + 5 + dist_bits[DistanceSymbol(token.distance)];
+            }
+        }
+
+        if (StoredCost(length) <= fixed_cost) {
+            WriteStoredBlocks(writer, data, length, final);
+        } else {
+            writer.PutBits(final ? 1 : 0, 1);
+            writer.PutBits(1, 2);
+            WriteTokens(writer, tokens.begin(), tokens.end(), lit_codes, GetFixedDistanceCodes());
+        }
+    }
+
+    struct Match
+    {
+        int length = 0;
+        int distance = 0;
+    };
+
+    // A level together with a strategy, from fastest to best compression
+    struct Rung
+    {
+        int level;
+        Strategy strategy;
+    };
+
+    constexpr inline std::array<Rung, 11> rungs{ {
+        { constants::level_Store, Strategy::Default },
+        { constants::level_Fastest, Strategy::Fastest },
+        { 1, Strategy::Default }, { 2, Strategy::Default }, { 3, Strategy::Default },
+        { 4, Strategy::Default }, { 5, Strategy::Default }, { 6, Strategy::Default },
+        { 7, Strategy::Default }, { 8, Strategy::Default }, { 9, Strategy::Default },
+    } };
+
+    // Amount of input per measurement of the encoding rate
+    constexpr std::size_t ADAPTIVE_INTERVAL = 65536;
+    // How much faster than the target the current rung must be before a
+    // slower one is tried
+    constexpr double ADAPTIVE_HEADROOM = 1.25;
+    // Number of intervals after which measurements are considered outdated
+    constexpr int ADAPTIVE_MAX_AGE = 32;
+
+    // Chooses the rung to encode with from the measured encoding rate and
+    // compression ratio of each: the slowest one that still meets the
+    // target, as long as it compresses better than the one below it
+    class ThroughputController
+    {
+    public:
+        ThroughputController(double target_mb_per_second, std::size_t rung)
+            : target(target_mb_per_second * 1e6)
+            , rung(rung)
+        {
+        }
+
+        std::size_t Current() const
+        {
+            return rung;
+        }
+
+        // Records that input_bytes were encoded to output_bits, taking
+        // seconds; returns true if the rung changed
+        bool Update(std::size_t input_bytes, std::uint64_t output_bits, double seconds)
+        {
+            interval_bytes += input_bytes;
+            interval_bits += output_bits;
+            interval_seconds += seconds;
+            if (interval_bytes < ADAPTIVE_INTERVAL) return false;
+
+            const double rate = interval_bytes / std::max(interval_seconds, 1e-9);
+            const double ratio = static_cast<double>(interval_bits) / interval_bytes;
+            auto& m = measurements[rung];
+            m.rate = m.age < ADAPTIVE_MAX_AGE ? (m.rate + rate) / 2 : rate;
+            m.ratio = m.age < ADAPTIVE_MAX_AGE ? (m.ratio + ratio) / 2 : ratio;
+            m.age = 0;
+            for(auto& other: measurements) other.age++;
+            interval_bytes = 0;
+            interval_bits = 0;
+            interval_seconds = 0;
+
+            if (rate < target) {
+                if (rung == 0) return false;
+                rung--;
+                return true;
+            }
+            if (rate < target * ADAPTIVE_HEADROOM || rung + 1 == rungs.size()) return false;
+            const auto& slower = measurements[rung + 1];
+            if (slower.age < ADAPTIVE_MAX_AGE && (slower.rate < target || slower.ratio >= m.ratio)) return false;
+            rung++;
+            return true;
+        }
+
+    private:
+        struct Measurement
+        {
+            double rate = 0; // bytes per second
+            double ratio = 0; // output bits per input byte
+            int age = ADAPTIVE_MAX_AGE; // intervals since last measured
+        };
+
+        const double target; // bytes per second
+        std::size_t rung;
+        std::array<Measurement, rungs.size()> measurements{};
+        std::size_t interval_bytes = 0;
+        std::uint64_t interval_bits = 0;
+        double interval_seconds = 0;
+    };
+
+    inline std::size_t FindRung(int level, Strategy strategy)
+    {
+        if (strategy == Strategy::Fastest) return 1;
+        const auto it = std::find_if(rungs.begin(), rungs.end(), [&](const auto& r) { return r.level >= level && r.strategy == Strategy::Default; });
+        return it == rungs.end() ? rungs.size() - 1 : std::distance(rungs.begin(), it);
+    }
+
+    // Input is checked for being incompressible in segments of this size;
+    // shorter spans are not judged
+    constexpr std::size_t INCOMPRESSIBLE_SEGMENT = 16384;
+    constexpr std::size_t INCOMPRESSIBLE_MIN_LENGTH = 4096;
+    // Order-0 entropy in bits per byte above which Huffman coding gains at
+    // most about 1%
+    constexpr double INCOMPRESSIBLE_ENTROPY = 7.92;
+    // Only every this many bytes are counted to estimate the entropy
+    constexpr std::size_t INCOMPRESSIBLE_STRIDE = 4;
+
+    // Guesses whether data is already compressed or random, from a sample of
+    // its bytes: these must be almost uniformly distributed. The estimate is
+    // corrected for the bias of a small sample (Miller-Madow)
+    inline bool LooksIncompressible(const std::uint8_t* data, std::size_t length)
+    {
+        std::array<std::uint32_t, 256> histogram{};
+        std::size_t samples = 0;
+        for(std::size_t n = 0; n < length; n += INCOMPRESSIBLE_STRIDE, samples++)
+            histogram[data[n]]++;
+        double bits = 0;
+        int symbols = 0;
+        for(const auto count: histogram) {
+            if (count == 0) continue;
+            bits -= count * std::log2(static_cast<double>(count) / samples);
+            symbols++;
+        }
+        bits += (symbols - 1) / (2 * std::log(2.0));
+        return bits >= INCOMPRESSIBLE_ENTROPY * samples;
+    }
+
+    // Guesses whether the data from data up to end repeats itself or the
+    // history from begin up to data. Runs of four positions every 32 bytes
+    // of data are sampled; as the scan for them visits every fourth
+    // position, a repeat at any distance lines up with one of each run
+    inline bool HasRepeats(const std::uint8_t* begin, const std::uint8_t* data, const std::uint8_t* end)
+    {
+        constexpr int table_bits = 12;
+        constexpr std::size_t sample_interval = 32;
+        constexpr std::size_t scan_stride = 4;
+        auto hash = [](const std::uint8_t* p) {
+            std::uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return (v * 0x9e3779b1u) >> (32 - table_bits);
+        };
+
+        // Entries hold the offset from begin plus one, zero is empty
+        std::array<std::uint32_t, std::size_t{1} << table_bits> table{};
+        std::size_t samples = 0;
+        for(auto p = data; p + sizeof(std::uint32_t) <= end; p++) {
+            if ((p - data) % sample_interval >= scan_stride) continue;
+            table[hash(p)] = static_cast<std::uint32_t>(p - begin + 1);
+            samples++;
+        }
+
+        std::size_t found = 0;
+        for(auto q = begin; q + sizeof(std::uint32_t) <= end; q += scan_stride) {
+            auto& entry = table[hash(q)];
+            if (entry == 0 || begin + entry - 1 <= q || std::memcmp(begin + entry - 1, q, sizeof(std::uint32_t)) != 0) continue;
+            entry = 0;
+            if (++found > samples / scan_stride / 64) return true;
+        }
+        return false;
+    }
+
+    // Number of leading bytes a and b have in common, up to max_length.
+    // Variants compare a word or vector at a time and locate the first
+    // mismatch from the comparison mask
+    using MatchLengthFn = int (*)(const std::uint8_t* a, const std::uint8_t* b, int max_length);
+
+    inline int MatchLengthBytewise(const std::uint8_t* a, const std::uint8_t* b, int max_length)
+    {
+        int length = 0;
+        while(length < max_length && a[length] == b[length])
+            length++;
+        return length;
+    }
+
+    inline int MatchLengthScalar(const std::uint8_t* a, const std::uint8_t* b, int max_length)
+    {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        int length = 0;
+        for(/* nothing */; length + 8 <= max_length; length += 8) {
+            std::uint64_t x, y;
+            std::memcpy(&x, a + length, sizeof(x));
+            std::memcpy(&y, b + length, sizeof(y));
+            if (const auto diff = x ^ y; diff != 0)
+                return length + (__builtin_ctzll(diff) >> 3);
+        }
+        return length + MatchLengthBytewise(a + length, b + length, max_length - length);
+#else
+        return MatchLengthBytewise(a, b, max_length);
+#endif
+    }
+
+#if defined(MINI_DEFLATE_X86_SIMD)
+    __attribute__((target("sse2")))
+    inline int MatchLengthSSE2(const std::uint8_t* a, const std::uint8_t* b, int max_length)
+    {
+        int length = 0;
+        for(/* nothing */; length + 16 <= max_length; length += 16) {
+            const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + length));
+            const auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + length));
+            const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+            if (mask != 0)
+                return length + __builtin_ctz(mask);
+        }
+        return length + MatchLengthScalar(a + length, b + length, max_length - length);
+    }
+
+    __attribute__((target("avx2")))
+    inline int MatchLengthAVX2(const std::uint8_t* a, const std::uint8_t* b, int max_length)
+    {
+        int length = 0;
+        for(/* nothing */; length + 32 <= max_length; length += 32) {
+            const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + length));
+            const auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + length));
+            const auto mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+            if (mask != 0)
+                return length + __builtin_ctz(mask);
+        }
+        return length + MatchLengthSSE2(a + length, b + length, max_length - length);
+    }
+#endif
+
+    // Selects the widest variant the CPU supports
+    inline MatchLengthFn GetMatchLengthFn()
+    {
+        static const MatchLengthFn fn = []() -> MatchLengthFn {
+#if defined(MINI_DEFLATE_X86_SIMD)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return MatchLengthAVX2;
+            if (__builtin_cpu_supports("sse2")) return MatchLengthSSE2;
+#endif
+            return MatchLengthScalar;
+        }();
+        return fn;
+    }
+
+    constexpr int OPTIMAL_ITERATIONS = 10;
+    constexpr std::size_t OPTIMAL_CHUNK_SIZE = 32768;
+
+    // Estimated bits per symbol, used to find the cheapest parse
+    struct CostModel
+    {
+        std::array<float, NUM_LITLEN_SYMBOLS> lit_bits;
+        std::array<float, NUM_DIST_SYMBOLS> dist_bits;
+
+        // Initial model, based on the fixed Huffman codes
+        CostModel()
+        {
+            for(int n = 0; n < NUM_LITLEN_SYMBOLS; n++) lit_bits[n] = GetFixedLengthCodeLengths()[n];
+            dist_bits.fill(5);
+        }
+
+        // Model derived from the symbols a previous parse produced
+        explicit CostModel(const BlockStatistics& stats)
+        {
+            auto fill = [](const auto& freqs, auto& bits) {
+                double total = 0;
+                for(auto f: freqs) total += f;
+                const auto unused_bits = static_cast<float>(std::log2(total + 1) + 1);
+                for(std::size_t n = 0; n < freqs.size(); n++)
+                    bits[n] = freqs[n] != 0 ? static_cast<float>(std::log2(total / freqs[n])) : unused_bits;
+            };
+            fill(stats.lit_freqs, lit_bits);
+            fill(stats.dist_freqs, dist_bits);
+        }
+
+        float Literal(std::uint8_t value) const
+        {
+            return lit_bits[value];
+        }
+
+        float Length(int length) const
+        {
+            const int l = LengthSymbolIndex(length);
+            return lit_bits[SYMBOL_REPEAT_FIRST + l] + repeat_extra_bits[l];
+        }
+
+        float Distance(int distance) const
+        {
+            const int d = DistanceSymbol(distance);
+            return dist_bits[d] + detail::dist_bits[d];
+        }
+    };
+
+    // Sizes of the encoder's tables and buffers, which are all allocated up
+    // front. The hash tables are only needed by the strategies using them
+    struct EncoderLayout
+    {
+        explicit EncoderLayout(const CompressOptions& options)
+            : adaptive(options.target_mb_per_second > 0 && (options.strategy == Strategy::Default || options.strategy == Strategy::Fastest))
+            , window_size(std::size_t{1} << options.window_bits)
+            , hash_bits(options.hash_bits)
+            , chain_size(std::size_t{1} << (options.chain_bits != 0 ? options.chain_bits : options.window_bits))
+            , max_block_tokens(std::min<std::size_t>(chain_size / 2, 16384))
+            , max_block_span(16 * max_block_tokens)
+            , piece_size(4 * window_size)
+        {
+            const bool chains = adaptive || ((options.strategy == Strategy::Default || options.strategy == Strategy::Filtered) && options.level != constants::level_Store);
+            head_entries = chains || options.strategy == Strategy::Fastest ? std::size_t{1} << hash_bits : 0;
+            prev_entries = chains ? chain_size : 0;
+            // The retained window, the input of the current block, the
+            // lookahead and a new piece of input; and what that can encode to
+            buffer_capacity = 2 * window_size + max_block_span + MIN_LOOKAHEAD + piece_size;
+            output_capacity = buffer_capacity + buffer_capacity / 512 + 64;
+        }
+
+        std::size_t AllocatedBytes() const
+        {
+            return (head_entries + prev_entries) * sizeof(std::uint32_t) + max_block_tokens * sizeof(Token) + buffer_capacity + output_capacity;
+        }
+
+        bool adaptive;
+        std::size_t window_size;
+        int hash_bits;
+        std::size_t chain_size;
+        std::size_t max_block_tokens;
+        std::size_t max_block_span; // amount of input after which a block ends
+        std::size_t piece_size; // largest amount of input written at once
+        std::size_t head_entries = 0;
+        std::size_t prev_entries = 0;
+        std::size_t buffer_capacity = 0;
+        std::size_t output_capacity = 0;
+    };
+
+    // LZ77 encoder state. Input is appended to buffer, of which we retain
+    // at least a window worth of history before the current position. The
+    // hash chains hold stream positions (buffer index + base) so that the
+    // buffer can be compacted without touching them; zero denotes an empty
+    // entry and is always too far away to be considered
+    class Encoder
+    {
+    public:
+        explicit Encoder(const CompressOptions& options)
+            : layout(options)
+            , window_size(layout.window_size)
+            , hash_bits(layout.hash_bits)
+            , chain_mask(layout.chain_size - 1)
+            , max_block_tokens(layout.max_block_tokens)
+            , level(options.level)
+            , strategy(options.strategy)
+            , config(level_configs[std::clamp(options.level, constants::level_Store, constants::level_Max)])
+            , head(layout.head_entries, 0)
+            , prev(layout.prev_entries, 0)
+        {
+            tokens.reserve(max_block_tokens);
+            buffer.reserve(layout.buffer_capacity);
+            writer.data.reserve(layout.output_capacity);
+            if (layout.adaptive) {
+                controller.emplace(options.target_mb_per_second, FindRung(level, strategy));
+                SetRung(controller->Current());
+            }
+            if (strategy == Strategy::Rle) {
+                probe_distances.push_back(1);
+            } else if (options.row_stride != 0 || strategy == Strategy::Rows) {
+                for(const auto distance: { std::max<std::size_t>(options.pixel_stride, 1), options.row_stride })
+                    if (distance != 0 && distance <= window_size && std::find(probe_distances.begin(), probe_distances.end(), distance) == probe_distances.end())
+                        probe_distances.push_back(distance);
+            }
+        }
+
+        const EncoderLayout& Layout() const
+        {
+            return layout;
+        }
+
+        template<typename Iterator>
+        void Write(Iterator it, Iterator endIt)
+        {
+            Compact();
+            buffer.insert(buffer.end(), it, endIt);
+        }
+
+        // Places data in the history, so that it can be referred to but will
+        // not be encoded itself
+        template<typename Iterator>
+        void SetDictionary(Iterator it, Iterator endIt)
+        {
+            const auto length = static_cast<std::size_t>(std::distance(it, endIt));
+            if (length > window_size) std::advance(it, length - window_size);
+            Write(it, endIt);
+            pos = buffer.size();
+            block_start = pos;
+            // Only the hash tables the strategy uses exist, keyed the way
+            // it looks them up; the others find their matches by probing
+            if (strategy == Strategy::Fastest)
+                InsertFastestUpTo(pos);
+            else if (!prev.empty())
+                InsertUpTo(pos);
+            else
+                insert_pos = pos;
+        }
+
+        // Prepares for a new stream, keeping all allocations. Rather than
+        // clearing the hash tables, stream positions move on by more than a
+        // window, which puts every existing entry out of reach
+        void Reset()
+        {
+            base = StreamPosition(buffer.size()) + window_size + 1;
+            buffer.clear();
+            tokens.clear();
+            writer.data.clear();
+            writer.bit_buf = 0;
+            writer.bit_count = 0;
+            pos = 0;
+            block_start = 0;
+            insert_pos = 0;
+            history_start = 0;
+            if (base > UINT32_C(0x80000000)) Rebase();
+        }
+
+        // Encodes pending input. Unless flushing, we keep enough input back
+        // to be able to find full-length matches once more arrives.
+        template<typename Callback>
+        void Encode(Flush flush, Callback callbackFn)
+        {
+            std::size_t limit = buffer.size();
+            if (flush == Flush::None)
+                limit = limit > MIN_LOOKAHEAD ? limit - MIN_LOOKAHEAD : 0;
+
+            if (!controller && strategy != Strategy::Fastest && level == constants::level_Store) {
+                pos = std::max(pos, limit);
+                const auto chunk = std::min(MAX_STORED_LENGTH, layout.max_block_span);
+                while(pos - block_start >= chunk) {
+                    WriteStoredBlocks(writer, &buffer[block_start], chunk, false);
+                    block_start += chunk;
+                }
+            } else {
+                // Segments of already compressed data are stored as-is, so
+                // no time is spent looking for matches that aren't there
+                while(pos < limit) {
+                    const auto start = pos;
+                    const auto start_bits = writer.BitCount();
+                    const auto start_time = std::chrono::steady_clock::now();
+                    const auto end = std::min(limit, pos + INCOMPRESSIBLE_SEGMENT);
+                    if (strategy != Strategy::Fastest && level == constants::level_Store)
+                        StoreSegment(end);
+                    else if (SegmentLooksIncompressible(end))
+                        StoreSegment(end);
+                    else
+                        Deflate(end);
+
+                    if (controller) {
+                        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+                        if (controller->Update(pos - start, writer.BitCount() - start_bits, elapsed.count()))
+                            SetRung(controller->Current());
+                    }
+                }
+            }
+
+            switch(flush) {
+                case Flush::None:
+                    break;
+                case Flush::Sync:
+                case Flush::Full:
+                    if (!tokens.empty() || pos != block_start)
+                        FlushBlock(false);
+                    WriteStoredBlocks(writer, nullptr, 0, false);
+                    if (flush == Flush::Full)
+                        ResetHistory();
+                    break;
+                case Flush::Finish:
+                    FlushBlock(true);
+                    writer.AlignToByte();
+                    break;
+            }
+            Deliver(callbackFn);
+        }
+
+    private:
+        // Switches to the level and strategy of a rung; as blocks are
+        // written according to these, the current block is completed first
+        void SetRung(std::size_t rung)
+        {
+            const auto& r = rungs[rung];
+            if (r.level == level && r.strategy == strategy) return;
+            if (pos != block_start) FlushBlock(false);
+            level = r.level;
+            strategy = r.strategy;
+            config = level_configs[level];
+        }
+
+        void Deflate(std::size_t limit)
+        {
+            if (strategy == Strategy::Fastest) {
+                DeflateFastest(limit);
+            } else if (strategy == Strategy::HuffmanOnly) {
+                DeflateHuffmanOnly(limit);
+            } else if (strategy == Strategy::Rle || strategy == Strategy::Rows) {
+                DeflateProbed(limit);
+            } else if (level == constants::level_Max) {
+                DeflateOptimal(limit);
+            } else if (config.lazy) {
+                DeflateLazy(limit);
+            } else {
+                DeflateGreedy(limit);
+            }
+        }
+
+        // Whether the input from pos up to end is better stored. Fastest is
+        // left alone, being cheap either way. Strategies that search for
+        // matches also need it not to repeat itself or the window
+        bool SegmentLooksIncompressible(std::size_t end) const
+        {
+            if (strategy == Strategy::Fastest || end - pos < INCOMPRESSIBLE_MIN_LENGTH) return false;
+            if (!LooksIncompressible(&buffer[pos], end - pos)) return false;
+            if (strategy != Strategy::Default && strategy != Strategy::Filtered) return true;
+            const auto start = std::max(history_start, pos > window_size ? pos - window_size : 0);
+            return !HasRepeats(&buffer[start], &buffer[pos], buffer.data() + end);
+        }
+
+        // Writes the data up to end as stored blocks. It is left out of the
+        // hash tables until a later segment is searched for matches, which
+        // then enters it first; so repeats of it can still be found
+        void StoreSegment(std::size_t end)
+        {
+            if (pos != block_start) FlushBlock(false);
+            WriteStoredBlocks(writer, &buffer[pos], end - pos, false);
+            pos = end;
+            block_start = pos;
+        }
+
+        std::uint32_t StreamPosition(std::size_t index) const
+        {
+            return static_cast<std::uint32_t>(base + index);
+        }
+
+        std::size_t Hash(std::size_t index) const
+        {
+            const std::uint32_t v = buffer[index] | (buffer[index + 1] << 8) | (buffer[index + 2] << 16);
+            return (v * 0x9e3779b1u) >> (32 - hash_bits);
+        }
+
+        std::uint32_t Load32(std::size_t index) const
+        {
+            std::uint32_t v;
+            std::memcpy(&v, &buffer[index], sizeof(v));
+            return v;
+        }
+
+        // Hash of the four bytes DeflateFastest() matches on
+        std::size_t FastestHash(std::uint32_t v) const
+        {
+            return (v * 0x9e3779b1u) >> (32 - hash_bits);
+        }
+
+        // Enters all positions before index in the hash heads, for
+        // DeflateFastest()
+        void InsertFastestUpTo(std::size_t index)
+        {
+            for(/* nothing */; insert_pos < index && insert_pos + sizeof(std::uint32_t) <= buffer.size(); insert_pos++)
+                head[FastestHash(Load32(insert_pos))] = StreamPosition(insert_pos);
+        }
+
+        // Inserts all positions before index into the hash chains
+        void InsertUpTo(std::size_t index)
+        {
+            for(/* nothing */; insert_pos < index && insert_pos + MIN_MATCH <= buffer.size(); insert_pos++) {
+                const auto h = Hash(insert_pos);
+                const auto p = StreamPosition(insert_pos);
+                prev[p & chain_mask] = head[h];
+                head[h] = p;
+            }
+        }
+
+        int MatchLength(std::size_t a, std::size_t b, int max_length) const
+        {
+            return match_length_fn(&buffer[a], &buffer[b], max_length);
+        }
+
+        // Finds the longest match at index that is better than prev_length
+        Match FindLongestMatch(std::size_t index, int prev_length)
+        {
+            Match best;
+            InsertUpTo(index + 1);
+            if (insert_pos <= index) return best;
+
+            const int max_length = static_cast<int>(std::min<std::size_t>(MAX_MATCH, buffer.size() - index));
+            const int nice_length = std::min(config.nice_length, max_length);
+            int chain = config.max_chain;
+            if (prev_length >= config.good_length) chain >>= 2;
+
+            const auto cur = StreamPosition(index);
+            int best_length = std::max(prev_length, MIN_MATCH - 1);
+            if (best_length >= max_length) return best;
+            if (!probe_distances.empty()) {
+                if (const auto match = Probe(index, max_length); match.length > best_length) {
+                    best = match;
+                    best_length = match.length;
+                    if (best_length >= nice_length) chain = 0;
+                }
+            }
+            for(auto cand = prev[cur & chain_mask]; chain > 0; chain--) {
+                if (cand >= cur || cur - cand > window_size) break;
+                const std::size_t cand_index = cand - base;
+                if (buffer[cand_index + best_length] == buffer[index + best_length] && buffer[cand_index] == buffer[index]) {
+                    const int length = MatchLength(cand_index, index, max_length);
+                    if (length > best_length) {
+                        best_length = length;
+                        best.length = length;
+                        best.distance = cur - cand;
+                        if (length >= nice_length) break;
+                    }
+                }
+                const auto next = prev[cand & chain_mask];
+                if (next >= cand) break;
+                cand = next;
+            }
+            if (best.length == MIN_MATCH && best.distance > TOO_FAR) best.length = 0;
+            if (strategy == Strategy::Filtered && best.length <= FILTERED_TOO_SHORT) best.length = 0;
+            return best;
+        }
+
+        void EmitLiteral(std::size_t index)
+        {
+            tokens.push_back(Token{ buffer[index], 0 });
+            if (BlockFull()) FlushBlock(false);
+        }
+
+        // Blocks end once the token buffer is full, or once they cover
+        // enough input that buffering more would exceed the memory budget
+        bool BlockFull() const
+        {
+            return tokens.size() >= max_block_tokens || pos - block_start >= layout.max_block_span;
+        }
+
+        void EmitMatch(const Match& match)
+        {
+            tokens.push_back(Token{ static_cast<std::uint16_t>(match.length), static_cast<std::uint16_t>(match.distance) });
+        }
+
+        void DeflateGreedy(std::size_t limit)
+        {
+            while(pos < limit) {
+                const auto match = FindLongestMatch(pos, 0);
+                if (match.length < MIN_MATCH) {
+                    EmitLiteral(pos++);
+                    continue;
+                }
+                EmitMatch(match);
+                pos += match.length;
+                // Long matches are not worth inserting into the hash chains
+                if (match.length > config.max_lazy) insert_pos = std::max(insert_pos, pos);
+                if (BlockFull()) FlushBlock(false);
+            }
+        }
+
+        // Looks up a single candidate per position, by a hash of four bytes.
+        // Only the hash heads are maintained; there are no chains to follow
+        void DeflateFastest(std::size_t limit)
+        {
+            constexpr int min_length = sizeof(std::uint32_t);
+            const auto end = buffer.size();
+            InsertFastestUpTo(pos);
+            while(pos < limit) {
+                if (pos + min_length > end) {
+                    EmitLiteral(pos++);
+                    continue;
+                }
+                const auto v = Load32(pos);
+                const auto h = FastestHash(v);
+                const auto cur = StreamPosition(pos);
+                const auto cand = head[h];
+                head[h] = cur;
+                if (cand >= cur || cur - cand > window_size || Load32(cand - base) != v) {
+                    EmitLiteral(pos++);
+                    continue;
+                }
+
+                const int max_length = static_cast<int>(std::min<std::size_t>(MAX_MATCH, end - pos));
+                Match match;
+                match.length = min_length + MatchLength(cand - base + min_length, pos + min_length, max_length - min_length);
+                match.distance = cur - cand;
+                EmitMatch(match);
+                pos += match.length;
+                if (BlockFull()) FlushBlock(false);
+            }
+            insert_pos = std::max(insert_pos, pos);
+        }
+
+        // Returns the longest match at one of the probe distances
+        Match Probe(std::size_t index, int max_length) const
+        {
+            Match best;
+            for(const auto distance: probe_distances) {
+                if (index < history_start + distance) continue;
+                const int length = MatchLength(index - distance, index, max_length);
+                if (length > best.length) {
+                    best.length = length;
+                    best.distance = static_cast<int>(distance);
+                }
+            }
+            return best;
+        }
+
+        // Only tries the probe distances; there are no hash chains
+        void DeflateProbed(std::size_t limit)
+        {
+            while(pos < limit) {
+                const int max_length = static_cast<int>(std::min<std::size_t>(MAX_MATCH, buffer.size() - pos));
+                if (max_length >= MIN_MATCH) {
+                    const auto match = Probe(pos, max_length);
+                    if (match.length >= MIN_MATCH) {
+                        EmitMatch(match);
+                        pos += match.length;
+                        if (BlockFull()) FlushBlock(false);
+                        continue;
+                    }
+                }
+                EmitLiteral(pos++);
+            }
+            insert_pos = std::max(insert_pos, pos);
+        }
+
+        void DeflateHuffmanOnly(std::size_t limit)
+        {
+            while(pos < limit)
+                EmitLiteral(pos++);
+            insert_pos = std::max(insert_pos, pos);
+        }
+
+        // Emits a match only if the next position doesn't yield a longer one
+        void DeflateLazy(std::size_t limit)
+        {
+            Match match;
+            bool have_match = false;
+            while(pos < limit) {
+                if (!have_match) match = FindLongestMatch(pos, 0);
+                have_match = false;
+                if (match.length < MIN_MATCH) {
+                    EmitLiteral(pos++);
+                    continue;
+                }
+                if (match.length < config.max_lazy) {
+                    const auto next = FindLongestMatch(pos + 1, match.length);
+                    if (next.length > match.length) {
+                        EmitLiteral(pos++);
+                        match = next;
+                        have_match = true;
+                        continue;
+                    }
+                }
+                EmitMatch(match);
+                pos += match.length;
+                if (BlockFull()) FlushBlock(false);
+            }
+        }
+
+        // Collects the matches at index as (length, distance) pairs of
+        // increasing length, where each distance is the closest one that
+        // reaches that length
+        void FindAllMatches(std::size_t index, std::size_t end, std::vector<Match>& matches)
+        {
+            InsertUpTo(index + 1);
+            if (insert_pos <= index) return;
+
+            const int max_length = static_cast<int>(std::min<std::size_t>(MAX_MATCH, end - index));
+            if (max_length < MIN_MATCH) return;
+            const auto cur = StreamPosition(index);
+            int best_length = MIN_MATCH - 1;
+            int chain = config.max_chain;
+            for(auto cand = prev[cur & chain_mask]; chain > 0; chain--) {
+                if (cand >= cur || cur - cand > window_size) break;
+                const std::size_t cand_index = cand - base;
+                if (buffer[cand_index + best_length] == buffer[index + best_length]) {
+                    const int length = MatchLength(cand_index, index, max_length);
+                    if (length > best_length) {
+                        best_length = length;
+                        matches.push_back(Match{ length, static_cast<int>(cur - cand) });
+                        if (length >= max_length) break;
+                    }
+                }
+                const auto next = prev[cand & chain_mask];
+                if (next >= cand) break;
+                cand = next;
+            }
+        }
+
+        // Finds the cheapest sequence of literals and matches for the data up
+        // to limit, in chunks. Each chunk is parsed repeatedly; every pass
+        // finds the shortest path through all literal and match choices,
+        // with costs derived from the symbols of the previous pass
+        void DeflateOptimal(std::size_t limit)
+        {
+            std::vector<Match> matches;
+            std::vector<std::uint32_t> match_offset;
+            std::vector<float> cost;
+            std::vector<Match> choice;
+            std::vector<Token> parse, best_parse;
+            while(pos < limit) {
+                const auto start = pos;
+                const auto end = std::min(limit, start + OPTIMAL_CHUNK_SIZE);
+                const auto length = end - start;
+
+                matches.clear();
+                match_offset.assign(1, 0);
+                for(std::size_t n = start; n < end; n++) {
+                    FindAllMatches(n, end, matches);
+                    match_offset.push_back(matches.size());
+                }
+
+                CostModel model;
+                double best_cost = 0;
+                for(int iteration = 0; iteration < OPTIMAL_ITERATIONS; iteration++) {
+                    cost.assign(length + 1, std::numeric_limits<float>::max());
+                    choice.assign(length + 1, Match{});
+                    cost[0] = 0;
+                    for(std::size_t n = 0; n < length; n++) {
+                        const float literal_cost = cost[n] + model.Literal(buffer[start + n]);
+                        if (literal_cost < cost[n + 1]) {
+                            cost[n + 1] = literal_cost;
+                            choice[n + 1] = Match{ 1, 0 };
+                        }
+                        int shorter = MIN_MATCH - 1;
+                        for(auto m = match_offset[n]; m < match_offset[n + 1]; m++) {
+                            const auto& match = matches[m];
+                            const float distance_cost = cost[n] + model.Distance(match.distance);
+                            for(int l = shorter + 1; l <= match.length; l++) {
+                                const float c = distance_cost + model.Length(l);
+                                if (c < cost[n + l]) {
+                                    cost[n + l] = c;
+                                    choice[n + l] = Match{ l, match.distance };
+                                }
+                            }
+                            shorter = match.length;
+                        }
+                    }
+
+                    parse.clear();
+                    for(std::size_t n = length; n > 0; n -= choice[n].length) {
+                        const auto& c = choice[n];
+                        if (c.distance == 0)
+                            parse.push_back(Token{ buffer[start + n - 1], 0 });
+                        else
+                            parse.push_back(Token{ static_cast<std::uint16_t>(c.length), static_cast<std::uint16_t>(c.distance) });
+                    }
+                    std::reverse(parse.begin(), parse.end());
+
+                    const auto stats = GatherStatistics(parse.begin(), parse.end());
+                    const double parse_cost = EstimateCost(stats);
+                    if (iteration == 0 || parse_cost < best_cost) {
+                        best_cost = parse_cost;
+                        std::swap(best_parse, parse);
+                    }
+                    model = CostModel{ stats };
+                }
+
+                for(const auto& token: best_parse) {
+                    tokens.push_back(token);
+                    pos += token.distance == 0 ? 1 : token.value;
+                    if (BlockFull()) FlushBlock(false);
+                }
+            }
+        }
+
+        void FlushBlock(bool final)
+        {
+            if (strategy == Strategy::Fastest) {
+                WriteFixedBlock(writer, tokens, buffer.data() + block_start, pos - block_start, final);
+            } else if (level == constants::level_Store) {
+                WriteStoredBlocks(writer, buffer.data() + block_start, pos - block_start, final);
+            } else if (strategy == Strategy::Rle || strategy == Strategy::Rows || strategy == Strategy::HuffmanOnly) {
+                // Searching for block splits would dominate the encoding time
+                WriteBlocks(writer, tokens.begin(), tokens.end(), buffer.data() + block_start, pos - block_start, final, MAX_SPLIT_DEPTH);
+            } else {
+                WriteBlocks(writer, tokens.begin(), tokens.end(), buffer.data() + block_start, pos - block_start, final);
+            }
+            tokens.clear();
+            block_start = pos;
+        }
+
+        template<typename Callback>
+        void Deliver(Callback callbackFn)
+        {
+            writer.FlushBytes();
+            if (writer.data.empty()) return;
+            callbackFn(writer.data);
+            writer.data.clear();
+        }
+
+        // Ensures no match will refer to anything before the current position
+        void ResetHistory()
+        {
+            std::fill(head.begin(), head.end(), 0);
+            insert_pos = pos;
+            history_start = pos;
+        }
+
+        // Discards data that is no longer needed for matching or for the
+        // current block
+        void Compact()
+        {
+            const auto keep_from = std::min(pos, block_start);
+            if (keep_from < 2 * window_size) return;
+            const auto drop = keep_from - window_size;
+            buffer.erase(buffer.begin(), buffer.begin() + drop);
+            pos -= drop;
+            block_start -= drop;
+            insert_pos = insert_pos > drop ? insert_pos - drop : 0;
+            history_start = history_start > drop ? history_start - drop : 0;
+            base += drop;
+            if (base > UINT32_C(0x80000000)) Rebase();
+        }
+
+        // Moves the stream positions back so they won't overflow; as entries
+        // are indexed modulo the window and chain sizes, we move by
+        // multiples of the window size, which is the larger
+        void Rebase()
+        {
+            const auto delta = static_cast<std::uint32_t>(((base - window_size - 1) / window_size) * window_size);
+            auto adjust = [&](std::uint32_t& p) { p = p > delta ? p - delta : 0; };
+            std::for_each(head.begin(), head.end(), adjust);
+            std::for_each(prev.begin(), prev.end(), adjust);
+            base -= delta;
+        }
+
+        const EncoderLayout layout;
+        const std::size_t window_size;
+        const int hash_bits;
+        const std::size_t chain_mask;
+        const std::size_t max_block_tokens;
+        int level;
+        Strategy strategy;
+        LevelConfig config;
+        std::optional<ThroughputController> controller;
+        const MatchLengthFn match_length_fn{ GetMatchLengthFn() };
+        std::vector<std::size_t> probe_distances;
+        std::vector<std::uint8_t> buffer;
+        std::size_t pos = 0; // next index to encode
+        std::size_t block_start = 0; // index where the current block starts
+        std::size_t insert_pos = 0; // next index to insert in the hash chains
+        std::size_t history_start = 0; // first index matches may refer to
+        std::size_t base = window_size + 1; // stream position of buffer[0]
+        std::vector<std::uint32_t> head;
+        std::vector<std::uint32_t> prev;
+        std::vector<Token> tokens;
+        BitWriter writer;
+    };
+
+} // namespace detail
+
+// Incremental encoder producing a raw deflate stream. Input can be supplied
+// in pieces; callbackFn is invoked with compressed output as it becomes
+// available
+class Deflater
+{
+public:
+    explicit Deflater(const CompressOptions& options = {})
+        : status(ValidateOptions(options))
+        , encoder(status == Result::OK ? options : CompressOptions{})
+    {
+    }
+
+    template<typename Iterator, typename Callback>
+    Result Write(Iterator it, Iterator endIt, Flush flush, Callback callbackFn)
+    {
+        if (status != Result::OK) return status;
+        if (finished) return Result::StreamFinished;
+
+        // Feed the encoder in pieces to keep its buffer bounded
+        const auto piece_size = encoder.Layout().piece_size;
+        for(auto left = std::distance(it, endIt); left > 0; /* nothing */) {
+            const auto n = std::min<decltype(left)>(left, piece_size);
+            const auto next = std::next(it, n);
+            encoder.Write(it, next);
+            encoder.Encode(Flush::None, callbackFn);
+            it = next;
+            left -= n;
+        }
+        if (flush != Flush::None)
+            encoder.Encode(flush, callbackFn);
+        finished = flush == Flush::Finish;
+        return Result::OK;
+    }
+
+    template<typename Data, typename Callback>
+    Result Write(const Data& data, Flush flush, Callback callbackFn)
+    {
+        return Write(data.begin(), data.end(), flush, callbackFn);
+    }
+
+    // Starts a new stream with the same options. The tables and buffers
+    // remain allocated, which makes this much cheaper than constructing a
+    // new Deflater for each of many small messages
+    void Reset()
+    {
+        encoder.Reset();
+        finished = false;
+    }
+
+    // Bytes allocated for the tables and buffers; encoding a block needs a
+    // few KiB more temporarily, level_Max considerably more
+    std::size_t MemoryUsage() const
+    {
+        return sizeof(*this) + encoder.Layout().AllocatedBytes();
+    }
+
+    // Primes the history with data the decoder is assumed to already have;
+    // only the final window of it is used. Must precede any Write()
+    template<typename Iterator>
+    void SetDictionary(Iterator it, Iterator endIt)
+    {
+        encoder.SetDictionary(it, endIt);
+    }
+
+private:
+    const Result status;
+    bool finished = false;
+    detail::Encoder encoder;
+};
+
+// Memory a Deflater with the given options will use, see MemoryUsage()
+inline std::size_t EncoderMemoryUsage(const CompressOptions& options)
+{
+    return sizeof(Deflater) + detail::EncoderLayout(options).AllocatedBytes();
+}
+
+// Compresses data to a raw deflate stream; callbackFn is invoked with each
+// piece of compressed output as it becomes available
+template<typename Data, typename Callback>
+Result Compress(const Data& data, Callback callbackFn, const CompressOptions& options = {})
+{
+    Deflater deflater{options};
+    return deflater.Write(data, Flush::Finish, callbackFn);
+}
+
+namespace constants
+{
+    constexpr inline std::size_t parallel_ChunkSize = 128 * 1024;
+}
+
+// Compresses data to a raw deflate stream using multiple threads. The input
+// is split in chunks which are compressed independently, each primed with
+// the window preceding it and ending in a sync flush; the concatenation
+// forms a single stream. As the chunking does not depend on the number of
+// threads, neither does the output. For the same reason target_mb_per_second
+// is ignored: its timing-driven level changes would make the output depend
+// on scheduling, so every chunk is compressed at the given level
+template<typename Data, typename Callback>
+Result CompressParallel(const Data& data, Callback callbackFn, const CompressOptions& options = {}, unsigned int num_threads = std::thread::hardware_concurrency(), std::size_t chunk_size = constants::parallel_ChunkSize)
+{
+    if (const auto result = ValidateOptions(options); result != Result::OK)
+        return result;
+    const auto window_size = std::size_t{1} << options.window_bits;
+    num_threads = std::max(num_threads, 1u);
+    chunk_size = std::max(chunk_size, window_size);
+
+    const auto length = static_cast<std::size_t>(std::distance(data.begin(), data.end()));
+    const auto num_chunks = std::max<std::size_t>((length + chunk_size - 1) / chunk_size, 1);
+    auto chunk_options = options;
+    chunk_options.target_mb_per_second = 0;
+
+    auto compressChunk = [&](Deflater& deflater, std::size_t chunk, std::vector<std::uint8_t>& output) {
+        const auto start = chunk * chunk_size;
+        const auto end = std::min(start + chunk_size, length);
+        deflater.Reset();
+        if (start > 0) {
+            const auto dict_start = start - std::min(start, window_size);
+            deflater.SetDictionary(std::next(data.begin(), dict_start), std::next(data.begin(), start));
+        }
+        const auto flush = chunk + 1 == num_chunks ? Flush::Finish : Flush::Sync;
+        deflater.Write(std::next(data.begin(), start), std::next(data.begin(), end), flush, [&](const auto& v) {
+            output.insert(output.end(), v.begin(), v.end());
+        });
+    };
+
+    // Chunks are processed in batches so that only a bounded amount of
+    // output is held before it is passed on in order
+    const std::size_t batch_size = 4 * num_threads;
+    std::vector<std::vector<std::uint8_t>> outputs(batch_size);
+    for(std::size_t first = 0; first < num_chunks; first += batch_size) {
+        const auto last = std::min(first + batch_size, num_chunks);
+        std::atomic<std::size_t> next_chunk{first};
+        auto worker = [&]() {
+            Deflater deflater{chunk_options};
+            for(auto chunk = next_chunk++; chunk < last; chunk = next_chunk++)
+                compressChunk(deflater, chunk, outputs[chunk - first]);
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned int n = 1; n < std::min<std::size_t>(num_threads, last - first); n++)
+            threads.emplace_back(worker);
+        worker();
+        for(auto& t: threads) t.join();
+
+        for(std::size_t chunk = first; chunk < last; chunk++) {
+            auto& output = outputs[chunk - first];
+            if (!output.empty()) callbackFn(output);
+            output.clear();
+        }
     }
     return Result::OK;
 }
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "mini-deflate.h"
+#include "mini-crc32.h"
+
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mini_gzip
+{
+
+namespace constants
+{
+    // RFC 1952, 2.3.1 Member header and trailer
+    constexpr inline std::uint8_t id1 = 0x1f;
+    constexpr inline std::uint8_t id2 = 0x8b;
+    constexpr inline std::uint8_t compressionMethod_deflate = 8;
+
+    constexpr inline std::uint8_t flag_FTEXT = (1 << 0);
+    constexpr inline std::uint8_t flag_FHCRC = (1 << 1);
+    constexpr inline std::uint8_t flag_FEXTRA = (1 << 2);
+    constexpr inline std::uint8_t flag_FNAME = (1 << 3);
+    constexpr inline std::uint8_t flag_FCOMMENT = (1 << 4);
+    constexpr inline std::uint8_t flag_Reserved = 0xe0;
+
+    constexpr inline std::uint8_t extraFlags_Best = 2;
+    constexpr inline std::uint8_t extraFlags_Fastest = 4;
+    constexpr inline std::uint8_t os_Unknown = 255;
+
+    // Deflate cannot expand data by more than this factor, which bounds
+    // the output size an ISIZE field can sensibly announce
+    constexpr inline std::size_t maximumExpansion = 1032;
+}
+
+enum class Result
+{
+    OK,
+    PrematureEndOfStream,
+    BadSignature,
+    UnsupportedCompressionMethod,
+    ReservedFlagsSet,
+    HeaderChecksumError,
+    DeflateError,
+    ChecksumError,
+    SizeError,
+    InvalidOptions,
+    InvalidHeader
+};
+
+// The optional fields of a member header. Decompression reports those of
+// the first member; compression writes the fields that are present
+struct Header
+{
+    bool text = false;
+    std::uint32_t modificationTime = 0;
+    std::uint8_t extraFlags = 0;
+    std::uint8_t os = constants::os_Unknown;
+    std::optional<std::vector<std::uint8_t>> extra;
+    std::optional<std::string> name;
+    std::optional<std::string> comment;
+    bool headerChecksum = false;
+};
+
+namespace detail
+{
+    // Reads header bytes, keeping the CRC-32 of all bytes read for FHCRC
+    template<typename Streamer>
+    struct HeaderReader
+    {
+        std::optional<std::uint8_t> GetByte()
+        {
+            const auto b = s.GetByte();
+            if (b.has_value()) crc.Update(&*b, 1);
+            return b;
+        }
+
+        // Multi-byte values are stored least significant byte first
+        template<typename Value> std::optional<Value> Get()
+        {
+            Value v = 0;
+            for(std::size_t n = 0; n < sizeof(Value); n++) {
+                const auto b = GetByte();
+                if (!b.has_value()) return {};
+                v |= static_cast<Value>(*b) << (8 * n);
+            }
+            return v;
+        }
+
+        std::optional<std::string> GetString()
+        {
+            std::string str;
+            while(true) {
+                const auto b = GetByte();
+                if (!b.has_value()) return {};
+                if (*b == 0) return str;
+                str += static_cast<char>(*b);
+            }
+        }
+
+        Streamer& s;
+        mini_crc32::CRC32 crc{};
+    };
+
+    // Reads a member header; its first byte has already been read, in order
+    // to find whether another member follows
+    template<typename Streamer>
+    Result ReadHeader(Streamer& s, std::uint8_t first, Header& header)
+    {
+        HeaderReader<Streamer> reader{s};
+        reader.crc.Update(&first, 1);
+        const auto id2 = reader.GetByte();
+        const auto cm = reader.GetByte();
+        const auto flg = reader.GetByte();
+        const auto mtime = reader.template Get<std::uint32_t>();
+        const auto xfl = reader.GetByte();
+        const auto os = reader.GetByte();
+        if (!id2.has_value() || !cm.has_value() || !flg.has_value() || !mtime.has_value() || !xfl.has_value() || !os.has_value()) return Result::PrematureEndOfStream;
+        if (first != constants::id1 || *id2 != constants::id2) return Result::BadSignature;
+        if (*cm != constants::compressionMethod_deflate) return Result::UnsupportedCompressionMethod;
+        if ((*flg & constants::flag_Reserved) != 0) return Result::ReservedFlagsSet;
+
+        header = Header{};
+        header.text = (*flg & constants::flag_FTEXT) != 0;
+        header.modificationTime = *mtime;
+        header.extraFlags = *xfl;
+        header.os = *os;
+        if ((*flg & constants::flag_FEXTRA) != 0) {
+            const auto xlen = reader.template Get<std::uint16_t>();
+            if (!xlen.has_value()) return Result::PrematureEndOfStream;
+            std::vector<std::uint8_t> extra;
+            extra.reserve(*xlen);
+            for(int n = 0; n < *xlen; n++) {
+                const auto b = reader.GetByte();
+                if (!b.has_value()) return Result::PrematureEndOfStream;
+                extra.push_back(*b);
+            }
+            header.extra = std::move(extra);
+        }
+        if ((*flg & constants::flag_FNAME) != 0) {
+            header.name = reader.GetString();
+            if (!header.name.has_value()) return Result::PrematureEndOfStream;
+        }
+        if ((*flg & constants::flag_FCOMMENT) != 0) {
+            header.comment = reader.GetString();
+            if (!header.comment.has_value()) return Result::PrematureEndOfStream;
+        }
+        if ((*flg & constants::flag_FHCRC) != 0) {
+            header.headerChecksum = true;
+            const auto expected = static_cast<std::uint16_t>(*reader.crc);
+            const auto crc16 = reader.template Get<std::uint16_t>();
+            if (!crc16.has_value()) return Result::PrematureEndOfStream;
+            if (*crc16 != expected) return Result::HeaderChecksumError;
+        }
+        return Result::OK;
+    }
+
+    // Reads the trailer and compares it with the CRC-32 and size (modulo
+    // 2^32) of the decompressed data
+    template<typename Streamer>
+    Result ReadTrailer(Streamer& s, mini_crc32::Value crc, std::uint32_t size)
+    {
+        HeaderReader<Streamer> reader{s};
+        const auto stored_crc = reader.template Get<std::uint32_t>();
+        const auto stored_size = reader.template Get<std::uint32_t>();
+        if (!stored_crc.has_value() || !stored_size.has_value()) return Result::PrematureEndOfStream;
+        if (*stored_crc != crc) return Result::ChecksumError;
+        if (*stored_size != size) return Result::SizeError;
+        return Result::OK;
+    }
+
+    // Decodes the members of a gzip file, until the streamer runs out
+    template<typename Streamer, typename InflateFn>
+    Result DecompressMembers(Streamer& s, Header* header, InflateFn inflateFn)
+    {
+        for(bool first = true; /* nothing */; first = false) {
+            const auto id1 = s.GetByte();
+            if (!id1.has_value()) return first ? Result::PrematureEndOfStream : Result::OK;
+
+            Header member_header;
+            if (auto result = ReadHeader(s, *id1, member_header); result != Result::OK) return result;
+            if (first && header != nullptr) *header = std::move(member_header);
+
+            mini_crc32::CRC32 crc;
+            std::uint32_t size = 0;
+            if (auto result = inflateFn([&](const auto& output) {
+                crc.Update(output.begin(), output.end());
+                size += static_cast<std::uint32_t>(output.size());
+            }); result != Result::OK) return result;
+            if (auto result = ReadTrailer(s, *crc, size); result != Result::OK) return result;
+        }
+    }
+
+    inline std::uint8_t GetExtraFlags(const mini_deflate::CompressOptions& options)
+    {
+        using mini_deflate::Strategy;
+        if (options.strategy == Strategy::Fastest || options.level == mini_deflate::constants::level_Fastest) return constants::extraFlags_Fastest;
+        if (options.level >= mini_deflate::constants::level_Best) return constants::extraFlags_Best;
+        return 0;
+    }
+
+    inline void AppendLittleEndian(std::vector<std::uint8_t>& v, std::uint32_t value, int bytes)
+    {
+        for(int n = 0; n < bytes; n++)
+            v.push_back(static_cast<std::uint8_t>(value >> (8 * n)));
+    }
+
+    // Returns the member header, or nothing if the header cannot be
+    // represented
+    inline std::optional<std::vector<std::uint8_t>> MakeHeader(const Header& header, const mini_deflate::CompressOptions& options)
+    {
+        auto isValidString = [](const std::optional<std::string>& s) {
+            return !s.has_value() || s->find('\0') == std::string::npos;
+        };
+        if (header.extra.has_value() && header.extra->size() > std::numeric_limits<std::uint16_t>::max()) return {};
+        if (!isValidString(header.name) || !isValidString(header.comment)) return {};
+
+        std::uint8_t flg = 0;
+        if (header.text) flg |= constants::flag_FTEXT;
+        if (header.headerChecksum) flg |= constants::flag_FHCRC;
+        if (header.extra.has_value()) flg |= constants::flag_FEXTRA;
+        if (header.name.has_value()) flg |= constants::flag_FNAME;
+        if (header.comment.has_value()) flg |= constants::flag_FCOMMENT;
+
+        std::vector<std::uint8_t> v{ constants::id1, constants::id2, constants::compressionMethod_deflate, flg };
+        AppendLittleEndian(v, header.modificationTime, 4);
+        v.push_back(GetExtraFlags(options));
+        v.push_back(header.os);
+        if (header.extra.has_value()) {
+            AppendLittleEndian(v, static_cast<std::uint32_t>(header.extra->size()), 2);
+            v.insert(v.end(), header.extra->begin(), header.extra->end());
+        }
+        for(const auto& s: { header.name, header.comment }) {
+            if (!s.has_value()) continue;
+            v.insert(v.end(), s->begin(), s->end());
+            v.push_back(0);
+        }
+        if (header.headerChecksum) {
+            mini_crc32::CRC32 crc;
+            crc.Update(v.begin(), v.end());
+            AppendLittleEndian(v, *crc, 2);
+        }
+        return v;
+    }
+
+    inline std::vector<std::uint8_t> MakeTrailer(mini_crc32::Value crc, std::size_t size)
+    {
+        std::vector<std::uint8_t> v;
+        AppendLittleEndian(v, crc, 4);
+        AppendLittleEndian(v, static_cast<std::uint32_t>(size), 4);
+        return v;
+    }
+
+    // Bytes of a span, as a streamer
+    struct SpanStreamer
+    {
+        std::optional<std::uint8_t> GetByte()
+        {
+            if (pos >= span.size()) return {};
+            return span[pos++];
+        }
+
+        mini_deflate::ByteSpan span;
+        std::size_t pos = 0;
+    };
+}
+
+// Decompresses a gzip file from a streamer, calling callback with the
+// output. Members are decoded until the streamer runs out; each member's
+// CRC-32 and size are verified. If header is not null, it receives the
+// header fields of the first member
+template<typename Streamer, typename Callback>
+Result Decompress(Streamer& s, Callback callback, Header* header = nullptr)
+{
+    return detail::DecompressMembers(s, header, [&](auto checksumFn) {
+        // The deflate data is read as needed, which leaves the trailer
+        // behind it unread
+        mini_deflate::StreamingBitStreamer bis{s, std::numeric_limits<std::size_t>::max()};
+        const auto result = mini_deflate::Decompress(bis, [&](const auto& output) {
+            checksumFn(output);
+            callback(output);
+        });
+        if (bis.Truncated()) return Result::PrematureEndOfStream;
+        return result == mini_deflate::Result::OK ? Result::OK : Result::DeflateError;
+    });
+}
+
+// Decompresses a gzip file held in memory, appending it to output. As the
+// whole file is available, the ISIZE field at its end is used to reserve
+// output up front; the members are then decoded directly into it. Should
+// the data run past ISIZE, output simply grows
+template<typename Data>
+Result DecompressBuffer(const Data& data, std::vector<std::uint8_t>& output, Header* header = nullptr)
+{
+    const mini_deflate::ByteSpan span{reinterpret_cast<const std::uint8_t*>(std::data(data)), std::size(data)};
+    if (span.size() >= 4) {
+        // Only exact for a single member, and not to be trusted blindly
+        std::uint32_t isize = 0;
+        for(int n = 0; n < 4; n++)
+            isize |= static_cast<std::uint32_t>(span[span.size() - 4 + n]) << (8 * n);
+        output.reserve(output.size() + std::min<std::size_t>(isize, span.size() * constants::maximumExpansion));
+    }
+
+    detail::SpanStreamer s{span};
+    return detail::DecompressMembers(s, header, [&](auto checksumFn) {
+        const mini_deflate::ByteSpan deflate_span{span.begin() + s.pos, span.size() - s.pos};
+        mini_deflate::BitStreamer bis{deflate_span};
+        const auto start = output.size();
+        const auto result = mini_deflate::DecompressAppend(bis, output);
+        if (result != mini_deflate::Result::OK)
+            return bis.eof() ? Result::PrematureEndOfStream : Result::DeflateError;
+        s.pos += bis.BytesRead();
+        checksumFn(mini_deflate::ByteSpan{output.data() + start, output.size() - start});
+        return Result::OK;
+    });
+}
+
+// Compresses data to a single-member gzip file, with the header fields given
+template<typename Data, typename Callback>
+Result Compress(const Data& data, Callback callback, const mini_deflate::CompressOptions& options = {}, const Header& header = {})
+{
+    if (mini_deflate::ValidateOptions(options) != mini_deflate::Result::OK) return Result::InvalidOptions;
+    const auto member_header = detail::MakeHeader(header, options);
+    if (!member_header.has_value()) return Result::InvalidHeader;
+
+    callback(*member_header);
+    mini_crc32::CRC32 crc;
+    crc.Update(data.begin(), data.end());
+    mini_deflate::Deflater deflater{options};
+    deflater.Write(data, mini_deflate::Flush::Finish, callback);
+    callback(detail::MakeTrailer(*crc, static_cast<std::size_t>(std::distance(data.begin(), data.end()))));
+    return Result::OK;
+}
+
+// As Compress(), using multiple threads for both the deflate stream and the
+// CRC-32; see mini_deflate::CompressParallel(). The data must be stored
+// contiguously
+template<typename Data, typename Callback>
+Result CompressParallel(const Data& data, Callback callback, const mini_deflate::CompressOptions& options = {}, const Header& header = {}, unsigned int num_threads = std::thread::hardware_concurrency())
+{
+    if (mini_deflate::ValidateOptions(options) != mini_deflate::Result::OK) return Result::InvalidOptions;
+    const auto member_header = detail::MakeHeader(header, options);
+    if (!member_header.has_value()) return Result::InvalidHeader;
+
+    callback(*member_header);
+    mini_deflate::CompressParallel(data, callback, options, num_threads);
+    const auto bytes = reinterpret_cast<const std::uint8_t*>(std::data(data));
+    callback(detail::MakeTrailer(mini_crc32::ChecksumParallel(bytes, std::size(data), num_threads), std::size(data)));
+    return Result::OK;
+}
+
+} // namespace mini_gzip
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <optional>
+#include <string>
 
+#include "mini-crc32.h"
 #include "mini-zlib.h"
 
 namespace mini_png
@@ -31,6 +34,16 @@ struct ByteStreamer
         pos += length;
     }
 
+    // Returns the next length bytes and skips past them, or nullptr if
+    // fewer remain
+    const uint8_t* GetBuffer(std::size_t length)
+    {
+        if (pos > data.size() || data.size() - pos < length) return nullptr;
+        const auto bytes = data.data() + pos;
+        pos += length;
+        return bytes;
+    }
+
     template<typename Value> std::optional<Value> Get()
     {
         // 2.1. All integers that require more than one byte are stored in
@@ -49,6 +62,78 @@ struct ByteStreamer
     std::size_t pos = 0;
 };
 
+// Passes bytes through from a ByteStreamer, computing the CRC-32 of those
+// read while enabled. Skipped bytes are read as well in that case
+template<typename ByteStreamer>
+struct ChecksumStreamer
+{
+    ChecksumStreamer(ByteStreamer& bs) : bs(bs) { }
+
+    bool eof() const
+    {
+        return bs.eof();
+    }
+
+    std::optional<uint8_t> GetByte()
+    {
+        const auto b = bs.GetByte();
+        if (enabled && b.has_value())
+            crc = (crc >> 8) ^ mini_crc32::detail::tables[0][(crc ^ *b) & 0xff];
+        return b;
+    }
+
+    void Skip(std::size_t length)
+    {
+        if (!enabled) {
+            bs.Skip(length);
+            return;
+        }
+        for(/* nothing */; length > 0; length--) {
+            if (!GetByte().has_value()) return;
+        }
+    }
+
+    // Only available if the underlying streamer provides it
+    template<typename S = ByteStreamer, typename = decltype(std::declval<S&>().GetBuffer(std::size_t{}))>
+    const uint8_t* GetBuffer(std::size_t length)
+    {
+        const auto bytes = bs.GetBuffer(length);
+        if (enabled && bytes != nullptr)
+            crc = ~mini_crc32::detail::GetUpdateFn()(~crc, bytes, length);
+        return bytes;
+    }
+
+    template<typename Value> std::optional<Value> Get()
+    {
+        Value v = 0;
+        for(int n = 0; n < sizeof(Value); n++)
+        {
+            const auto b = GetByte();
+            if (!b.has_value()) return {};
+            v = (v << 8) | *b;
+        }
+        return v;
+    }
+
+    void StartChecksum()
+    {
+        crc = ~mini_crc32::constants::initial_CRC32;
+        enabled = true;
+    }
+
+    // Stops checksumming and returns the CRC-32 of the bytes since
+    // StartChecksum()
+    mini_crc32::Value StopChecksum()
+    {
+        enabled = false;
+        return ~crc;
+    }
+
+    ByteStreamer& bs;
+    mini_crc32::Value crc{};
+    bool enabled{};
+};
+
 namespace field
 {
     // Layout and types outlined in 3.2
@@ -155,6 +240,39 @@ namespace chunk_types
     constexpr auto type_IEND = FromIdentifier({ 'I', 'E', 'N', 'D' });
 } // namespace chunk_types
 
+enum class Result
+{
+    OK,
+    PrematureEndOfFile,
+    BadSignature,
+    InvalidFirstChunk,
+    MultipleIHDR,
+    InvalidWidth,
+    InvalidHeight,
+    InvalidColorTypeAndBitDepthCombination,
+    UnsupportedCompressionMethod,
+    UnsupportedFilterMethod,
+    UnsupportedInterlaceMethod,
+    UnsupportedCriticalChunkEncountered,
+    ZlibError,
+    UnsupportedFilterType,
+    ChecksumError
+};
+
+// Which chunk CRCs Parse() verifies
+enum class ChecksumPolicy
+{
+    All,
+    CriticalOnly,
+    None
+};
+
+namespace detail
+{
+    template<typename T> struct IsChecksumStreamer : std::false_type { };
+    template<typename T> struct IsChecksumStreamer<ChecksumStreamer<T>> : std::true_type { };
+}
+
 template<typename ByteStreamer>
 struct Chunk
 {
@@ -162,7 +280,9 @@ struct Chunk
 
     bool ReadHeader()
     {
+        // 5.3 The CRC covers the type and data, but not the length
         const auto l = bs.template Get<field::Length>();
+        if constexpr (IsChecksumStreamer()) bs.StartChecksum();
         const auto t = bs.template Get<field::Type>();
         if (!l.has_value() || !t.has_value()) return false;
         length = *l;
@@ -175,29 +295,35 @@ struct Chunk
         bs.Skip(length + sizeof(field::Checksum));
     }
 
+    // Whether the CRC of this chunk is to be computed as its data is read;
+    // the type must be known
+    bool IsChecksummed(ChecksumPolicy policy) const
+    {
+        return policy == ChecksumPolicy::All || (policy == ChecksumPolicy::CriticalOnly && !type.IsAncillary());
+    }
+
+    // Reads the CRC following the chunk data, and compares it with the one
+    // computed if the chunk is checksummed
+    Result ReadChecksum(ChecksumPolicy policy)
+    {
+        static_assert(IsChecksumStreamer());
+        const auto computed = bs.StopChecksum();
+        const auto stored = bs.template Get<field::Checksum>();
+        if (!stored.has_value()) return Result::PrematureEndOfFile;
+        if (IsChecksummed(policy) && *stored != computed) return Result::ChecksumError;
+        return Result::OK;
+    }
+
+    static constexpr bool IsChecksumStreamer()
+    {
+        return detail::IsChecksumStreamer<ByteStreamer>::value;
+    }
+
     ByteStreamer& bs;
     field::Length length;
     ChunkType type;
 };
 
-enum class Result
-{
-    OK,
-    PrematureEndOfFile,
-    BadSignature,
-    InvalidFirstChunk,
-    MultipleIHDR,
-    InvalidWidth,
-    InvalidHeight,
-    InvalidColorTypeAndBitDepthCombination,
-    UnsupportedCompressionMethod,
-    UnsupportedFilterMethod,
-    UnsupportedInterlaceMethod,
-    UnsupportedCriticalChunkEncountered,
-    ZlibError,
-    UnsupportedFilterType
-};
-
 struct ImageHeader
 {
     field::Width width;
@@ -227,6 +353,17 @@ struct ImageHeader
     {
         return width * GetBytesPerPixel();
     }
+
+    // Options to compress the filtered image data with: each scanline is
+    // preceded by its filter type byte
+    mini_deflate::CompressOptions GetCompressOptions(mini_deflate::Strategy strategy = mini_deflate::Strategy::Rows) const
+    {
+        mini_deflate::CompressOptions options;
+        options.strategy = strategy;
+        options.row_stride = GetScanLineLengthInBytes() + 1;
+        options.pixel_stride = std::max<std::size_t>(GetBytesPerPixel(), 1);
+        return options;
+    }
 };
 
 uint16_t PaethPredictor(uint8_t a, uint8_t b, uint8_t c)
@@ -381,28 +518,33 @@ Result ParseImageHeader(ByteStreamer& bs, ImageHeader& ihdr)
     if (ihdr.compressionMethod != field::constants::compressionMethod_Deflate) return Result::UnsupportedCompressionMethod;
     if (ihdr.filterMethod != field::constants::filterMethod_Adaptive) return Result::UnsupportedFilterMethod;
     if (ihdr.interlaceMethod != field::constants::interlaceMethod_None) return Result::UnsupportedInterlaceMethod; // XXX what about Adam7
-    bs.Skip(sizeof(field::Checksum)); // XXX TODO PARSE
     return Result::OK;
 }
 
+// Parses a PNG file, invoking imageHeaderFn with the IHDR contents and
+// scanLineFn for every decoded scanline. Chunk CRCs selected by the policy
+// are verified as the chunk data is read
 template<typename ByteStreamer, typename ImageHeaderFn, typename ScanLineFn>
-Result Parse(ByteStreamer& bs, ImageHeaderFn imageHeaderFn, ScanLineFn scanLineFn)
+Result Parse(ByteStreamer& input, ImageHeaderFn imageHeaderFn, ScanLineFn scanLineFn, ChecksumPolicy policy = ChecksumPolicy::CriticalOnly)
 {
     // 3.1 PNG file signature
     {
         for(auto signature_byte: field::constants::png_signature) {
-            const auto byte = bs.GetByte();
+            const auto byte = input.GetByte();
             if (!byte.has_value()) return Result::PrematureEndOfFile;
             if (*byte != signature_byte) return Result::BadSignature;
         }
     }
 
     // 3.2 First chunk must be IHDR
+    ChecksumStreamer bs{input};
     Chunk header{bs};
     if (!header.ReadHeader()) return Result::PrematureEndOfFile;
     if (header.type != chunk_types::type_IHDR) return Result::InvalidFirstChunk;
+    if (!header.IsChecksummed(policy)) bs.StopChecksum();
     ImageHeader ihdr;
     if (auto result = ParseImageHeader(bs, ihdr); result != Result::OK) return result;
+    if (auto result = header.ReadChecksum(policy); result != Result::OK) return result;
     imageHeaderFn(ihdr);
 
     // Set up the decode context; data may be scattered over multiple IDAT
@@ -414,20 +556,22 @@ Result Parse(ByteStreamer& bs, ImageHeaderFn imageHeaderFn, ScanLineFn scanLineF
     {
         Chunk chunk{bs};
         if (!chunk.ReadHeader()) return Result::PrematureEndOfFile;
+        if (!chunk.IsChecksummed(policy)) bs.StopChecksum();
         if (chunk.type == chunk_types::type_IHDR) return Result::MultipleIHDR;
         if (chunk.type == chunk_types::type_IDAT)
         {
             if (auto result = ParseImageData(chunk, bs, dctx, scanLineFn); result != Result::OK) return result;
-            bs.Skip(sizeof(field::Checksum)); // XXX TODO PARSE
+            if (auto result = chunk.ReadChecksum(policy); result != Result::OK) return result;
             continue;
         }
         if (chunk.type == chunk_types::type_IEND)
         {
-            bs.Skip(sizeof(field::Checksum)); // XXX TODO PARSE
+            if (auto result = chunk.ReadChecksum(policy); result != Result::OK) return result;
             break;
         }
         if (!chunk.type.IsAncillary()) return Result::UnsupportedCriticalChunkEncountered;
-        chunk.Skip();
+        bs.Skip(chunk.length);
+        if (auto result = chunk.ReadChecksum(policy); result != Result::OK) return result;
     }
 
     return Result::OK;
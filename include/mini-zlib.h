@@ -3,6 +3,9 @@
 #include "mini-deflate.h"
 #include "mini-adler32.h"
 
+#include <type_traits>
+#include <utility>
+
 namespace mini_zlib
 {
 
@@ -10,6 +13,8 @@ namespace constants
 {
     constexpr inline std::uint8_t compressionMethod_deflate = 8;
     constexpr inline std::uint8_t flag_FDICT = (1 << 5);
+    // CINFO is the base-2 logarithm of the window size, minus eight
+    constexpr inline int maximumCompressionInfo = 7;
 }
 
 enum class Result
@@ -19,11 +24,54 @@ enum class Result
     UnsupportedCompressionMethod,
     HeaderChecksumError,
     DeflateError,
-    ChecksumError
+    ChecksumError,
+    InvalidWindowSize,
+    InvalidOptions,
+    UnknownDictionary
 };
 
-template<typename Streamer, typename Callback>
-Result Decompress(Streamer& s, std::size_t length, Callback callback)
+// How Decompress() treats the Adler-32 trailer: Verify compares it with the
+// checksum of the output, Skip does not compute the checksum at all and
+// Defer computes it but leaves the comparison to the caller
+enum class ChecksumPolicy
+{
+    Verify,
+    Skip,
+    Defer
+};
+
+// The trailer as stored, and as computed from the output unless skipped
+struct Checksums
+{
+    mini_adler32::Value stored{};
+    std::optional<mini_adler32::Value> computed;
+
+    bool Matches() const { return computed.has_value() && *computed == stored; }
+};
+
+namespace detail
+{
+    // Streamers may provide GetBuffer(length), returning a pointer to the
+    // next length bytes and skipping past them, or nullptr if fewer remain
+    template<typename Streamer, typename = void>
+    struct HasGetBuffer : std::false_type { };
+
+    template<typename Streamer>
+    struct HasGetBuffer<Streamer, std::void_t<decltype(std::declval<Streamer&>().GetBuffer(std::size_t{}))>> : std::true_type { };
+}
+
+// Dictionary lookup for streams that are not expected to use one
+inline constexpr auto noDictionary = [](mini_adler32::Value) -> const std::vector<uint8_t>* { return nullptr; };
+
+// Decompresses a zlib stream of length bytes. For streams compressed with a
+// preset dictionary, dictionaryFn is invoked with the Adler-32 id of the
+// dictionary and must return a pointer to it, or nullptr if it is unknown.
+// The trailer is handled per policy; if checksums is not null, it receives
+// the stored and computed values. The deflate data is not copied: it is
+// decoded from the streamer's buffer if it provides GetBuffer(), and read
+// byte by byte as needed otherwise
+template<typename Streamer, typename Callback, typename DictionaryFn>
+Result Decompress(Streamer& s, std::size_t length, Callback callback, DictionaryFn dictionaryFn, ChecksumPolicy policy, Checksums* checksums = nullptr)
 {
     const auto cmf = s.GetByte();
     const auto flg = s.GetByte();
@@ -33,33 +81,143 @@ Result Decompress(Streamer& s, std::size_t length, Callback callback)
     const auto cinfo = (*cmf >> 4) & 0xf;
     if (cm != constants::compressionMethod_deflate) return Result::UnsupportedCompressionMethod;
     if (((*cmf * 256) + *flg) % 31 != 0) return Result::HeaderChecksumError;
+    if (cinfo > constants::maximumCompressionInfo) return Result::InvalidWindowSize;
 
-    const bool fdict = (*flg & constants::flag_FDICT) != 0;
-    if (fdict) {
-        // Skip preset dictionary; this is only useful for recompression
-        s.Skip(4);
+    std::size_t headerLength = 2;
+    decltype(dictionaryFn(mini_adler32::Value{})) dictionary{};
+    if ((*flg & constants::flag_FDICT) != 0) {
+        const auto id = mini_adler32::ReadChecksum(s);
+        if (!id.has_value()) return Result::PrematureEndOfStream;
+        dictionary = dictionaryFn(*id);
+        if (dictionary == nullptr) return Result::UnknownDictionary;
+        headerLength += sizeof(mini_adler32::Value);
     }
 
-    // TODO we should be able to stream towards the deflate code
-    std::vector<uint8_t> compressedData;
-    compressedData.reserve(length);
-    for(std::size_t n = 2 + sizeof(mini_adler32::Value); n < length; n++)
-    {
-        const auto v = s.GetByte();
-        if (!v.has_value()) return Result::PrematureEndOfStream;
-        compressedData.push_back(*v);
+    // The deflate data is read directly from the streamer, or from its
+    // buffer if it can provide one
+    if (length < headerLength + sizeof(mini_adler32::Value)) return Result::PrematureEndOfStream;
+    const auto deflateLength = length - headerLength - sizeof(mini_adler32::Value);
+    mini_adler32::Adler32 adler;
+    const bool computeChecksum = policy != ChecksumPolicy::Skip;
+    auto checksumAndCallback = [&](const auto& output) {
+        if (computeChecksum) adler.Update(output.begin(), output.end());
+        callback(output);
+    };
+    auto inflate = [&](auto& bis) {
+        return dictionary != nullptr ? mini_deflate::Decompress(bis, *dictionary, checksumAndCallback) : mini_deflate::Decompress(bis, checksumAndCallback);
+    };
+
+    auto result = mini_deflate::Result::OK;
+    const std::uint8_t* buffer = nullptr;
+    if constexpr (detail::HasGetBuffer<Streamer>::value) buffer = s.GetBuffer(deflateLength);
+    if (buffer != nullptr) {
+        const mini_deflate::ByteSpan span{buffer, deflateLength};
+        mini_deflate::BitStreamer bis{span};
+        result = inflate(bis);
+    } else {
+        mini_deflate::StreamingBitStreamer bis{s, deflateLength};
+        result = inflate(bis);
+        if (bis.Truncated()) return Result::PrematureEndOfStream;
+        if (result == mini_deflate::Result::OK) s.Skip(bis.Remaining());
     }
+    if (result != mini_deflate::Result::OK) return Result::DeflateError;
+
     const auto checksum = mini_adler32::ReadChecksum(s);
     if (!checksum.has_value()) return Result::PrematureEndOfStream;
 
-    mini_deflate::BitStreamer bis{compressedData};
-    mini_adler32::Adler32 adler;
-    auto result = mini_deflate::Decompress(bis, [&](const auto& output) {
-        adler.Update(output.begin(), output.end());
-        callback(output);
-    });
-    if (result != mini_deflate::Result::OK) return Result::ChecksumError;
-    if (*adler != checksum) return Result::ChecksumError;
+    Checksums values{ *checksum, computeChecksum ? std::optional{ *adler } : std::nullopt };
+    if (checksums != nullptr) *checksums = values;
+    if (policy == ChecksumPolicy::Verify && !values.Matches()) return Result::ChecksumError;
+    return Result::OK;
+}
+
+template<typename Streamer, typename Callback, typename DictionaryFn>
+Result Decompress(Streamer& s, std::size_t length, Callback callback, DictionaryFn dictionaryFn)
+{
+    return Decompress(s, length, callback, dictionaryFn, ChecksumPolicy::Verify);
+}
+
+template<typename Streamer, typename Callback>
+Result Decompress(Streamer& s, std::size_t length, Callback callback)
+{
+    return Decompress(s, length, callback, noDictionary, ChecksumPolicy::Verify);
+}
+
+namespace detail
+{
+    // FLEVEL only informs whether recompression might be worthwhile
+    inline std::uint8_t GetCompressionLevelFlag(const mini_deflate::CompressOptions& options)
+    {
+        using mini_deflate::Strategy;
+        if (options.strategy == Strategy::Fastest || options.strategy == Strategy::Rle || options.strategy == Strategy::HuffmanOnly || options.level < 2) return 0;
+        if (options.level < mini_deflate::constants::level_Default) return 1;
+        if (options.level == mini_deflate::constants::level_Default) return 2;
+        return 3;
+    }
+
+    inline std::vector<uint8_t> MakeHeader(const mini_deflate::CompressOptions& options, bool fdict)
+    {
+        const std::uint8_t cmf = ((options.window_bits - 8) << 4) | constants::compressionMethod_deflate;
+        std::uint8_t flg = GetCompressionLevelFlag(options) << 6;
+        if (fdict) flg |= constants::flag_FDICT;
+        flg |= 31 - (cmf * 256 + flg) % 31;
+        return { cmf, flg };
+    }
+
+    inline std::vector<uint8_t> MakeChecksum(mini_adler32::Value value)
+    {
+        return { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+    }
+
+    template<typename Data, typename Dictionary, typename Callback>
+    Result Compress(const Data& data, const Dictionary* dictionary, Callback callback, const mini_deflate::CompressOptions& options)
+    {
+        if (mini_deflate::ValidateOptions(options) != mini_deflate::Result::OK) return Result::InvalidOptions;
+
+        callback(MakeHeader(options, dictionary != nullptr));
+        mini_deflate::Deflater deflater{options};
+        if (dictionary != nullptr) {
+            mini_adler32::Adler32 id;
+            id.Update(dictionary->begin(), dictionary->end());
+            callback(MakeChecksum(*id));
+            deflater.SetDictionary(dictionary->begin(), dictionary->end());
+        }
+        mini_adler32::Adler32 adler;
+        adler.Update(data.begin(), data.end());
+        deflater.Write(data, mini_deflate::Flush::Finish, callback);
+        callback(MakeChecksum(*adler));
+        return Result::OK;
+    }
+}
+
+// Compresses data to a zlib stream; the header announces the window size
+// used, so that decoders can size their own accordingly
+template<typename Data, typename Callback>
+Result Compress(const Data& data, Callback callback, const mini_deflate::CompressOptions& options = {})
+{
+    return detail::Compress(data, static_cast<const Data*>(nullptr), callback, options);
+}
+
+// As Compress(), with the window primed with a preset dictionary. The
+// stream refers to it by its Adler-32 id; decoders need the same dictionary
+template<typename Data, typename Dictionary, typename Callback>
+Result CompressWithDictionary(const Data& data, const Dictionary& dictionary, Callback callback, const mini_deflate::CompressOptions& options = {})
+{
+    return detail::Compress(data, &dictionary, callback, options);
+}
+
+// As Compress(), using multiple threads for both the deflate stream and the
+// checksum; see mini_deflate::CompressParallel(). The data must be stored
+// contiguously
+template<typename Data, typename Callback>
+Result CompressParallel(const Data& data, Callback callback, const mini_deflate::CompressOptions& options = {}, unsigned int num_threads = std::thread::hardware_concurrency())
+{
+    if (mini_deflate::ValidateOptions(options) != mini_deflate::Result::OK) return Result::InvalidOptions;
+
+    callback(detail::MakeHeader(options, false));
+    mini_deflate::CompressParallel(data, callback, options, num_threads);
+    const auto bytes = reinterpret_cast<const std::uint8_t*>(std::data(data));
+    callback(detail::MakeChecksum(mini_adler32::ChecksumParallel(bytes, std::size(data), num_threads)));
     return Result::OK;
 }
 
@@ -1,5 +1,8 @@
 #include "gtest/gtest.h"
 #include "mini-adler32.h"
+#include "random-data.h"
+
+#include <list>
 
 namespace
 {
@@ -26,3 +29,155 @@ TEST(Adler32, Wikipedia)
     };
     Verify(data, 0x11e60398);
 }
+
+TEST(Adler32, Variants)
+{
+    std::vector<mini_adler32::detail::UpdateFn> variants{
+        mini_adler32::detail::UpdateScalar,
+        mini_adler32::detail::GetUpdateFn(),
+    };
+#if defined(MINI_ADLER32_X86_SIMD)
+    variants.push_back(mini_adler32::detail::UpdateSSE2);
+    if (__builtin_cpu_supports("ssse3"))
+        variants.push_back(mini_adler32::detail::UpdateSSSE3);
+    if (__builtin_cpu_supports("avx2"))
+        variants.push_back(mini_adler32::detail::UpdateAVX2);
+#endif
+
+    // Long enough to need several reductions; all ones are the worst case
+    // for overflow
+    const auto data = MakeRandomData(3 * mini_adler32::constants::nmax + 100, 1);
+    const std::vector<uint8_t> ones(data.size(), 0xff);
+
+    for(const auto& input: { data, ones }) {
+        for(const std::size_t offset: { 0, 1, 7 }) {
+            for(const std::size_t length: { std::size_t{0}, std::size_t{1}, std::size_t{31}, std::size_t{32}, std::size_t{100}, mini_adler32::constants::nmax, input.size() - offset }) {
+                // Reference: the definition, reducing after every byte
+                uint32_t s1 = 1, s2 = 0;
+                for(std::size_t n = offset; n < offset + length; n++) {
+                    s1 = (s1 + input[n]) % mini_adler32::constants::base;
+                    s2 = (s2 + s1) % mini_adler32::constants::base;
+                }
+                const auto expected = (s2 << 16) | s1;
+                for(const auto fn: variants)
+                    EXPECT_EQ(expected, fn(mini_adler32::constants::initial_Adler32, input.data() + offset, length));
+
+                // Non-contiguous input takes the generic path
+                const std::list<uint8_t> list(input.begin() + offset, input.begin() + offset + length);
+                Verify(list, expected);
+            }
+        }
+    }
+
+    // Contiguous, but neither pointers nor byte values: each bool counts as
+    // a byte of 0 or 1
+    constexpr std::array<uint8_t, 4> values{ 1, 0, 1, 1 };
+    const auto expected = mini_adler32::detail::UpdateScalar(mini_adler32::constants::initial_Adler32, values.data(), values.size());
+    Verify(std::vector<bool>{ true, false, true, true }, expected);
+    Verify(std::vector<std::byte>{ std::byte{1}, std::byte{0}, std::byte{1}, std::byte{1} }, expected);
+}
+
+TEST(Adler32, Incremental)
+{
+    const std::string text(10000, 'x');
+    mini_adler32::Adler32 whole, pieces;
+    whole.Update(text.begin(), text.end());
+    for(std::size_t n = 0; n < text.size(); n += 333)
+        pieces.Update(text.begin() + n, text.begin() + std::min(n + 333, text.size()));
+    EXPECT_EQ(*whole, *pieces);
+}
+
+TEST(Adler32, Combine)
+{
+    const auto data = MakeRandomData(100000, 7);
+    mini_adler32::Adler32 whole;
+    whole.Update(data.begin(), data.end());
+
+    for(const std::size_t split: { std::size_t{0}, std::size_t{1}, std::size_t{65521}, std::size_t{70000}, data.size() }) {
+        mini_adler32::Adler32 a, b;
+        a.Update(data.begin(), data.begin() + split);
+        b.Update(data.begin() + split, data.end());
+        EXPECT_EQ(*whole, mini_adler32::Combine(*a, *b, data.size() - split));
+    }
+
+    for(const unsigned int num_threads: { 1, 2, 3, 16 }) {
+        for(const std::size_t chunk_size: { 1, 1000, 4096, 1 << 20 })
+            EXPECT_EQ(*whole, mini_adler32::ChecksumParallel(data.data(), data.size(), num_threads, chunk_size));
+    }
+    EXPECT_EQ(mini_adler32::constants::initial_Adler32, mini_adler32::ChecksumParallel(data.data(), 0, 4));
+}
+
+TEST(Adler32, Rolling)
+{
+    auto data = MakeRandomData(20000, 3);
+    std::fill(data.begin() + 5000, data.begin() + 10000, 0xff);
+
+    for(const std::size_t window_size: { 1, 16, 5552, 70000 }) {
+        mini_adler32::RollingAdler32 rolling{window_size};
+        for(std::size_t n = 0; n < data.size(); n++) {
+            rolling.Update(data[n]);
+            if (n % 97 != 0 && n + 1 != window_size) continue;
+            const auto start = n + 1 - std::min(n + 1, window_size);
+            mini_adler32::Adler32 adler;
+            adler.Update(data.begin() + start, data.begin() + n + 1);
+            ASSERT_EQ(*adler, *rolling) << "window " << window_size << " at " << n;
+            EXPECT_EQ(n + 1 >= window_size, rolling.Full());
+        }
+    }
+}
+
+TEST(Adler32, Chunker)
+{
+    const auto data = MakeRandomData(300000, 11);
+
+    auto chunk = [](const std::vector<uint8_t>& input, const mini_adler32::ChunkerOptions& options) {
+        std::vector<std::size_t> lengths;
+        mini_adler32::Chunk(input, [&](std::size_t length) { lengths.push_back(length); }, options);
+        return lengths;
+    };
+    // Chunk boundaries as offsets from the end, which an earlier edit does
+    // not change
+    auto boundariesFromEnd = [](const std::vector<std::size_t>& lengths) {
+        std::vector<std::size_t> result;
+        std::size_t remaining = 0;
+        for(auto it = lengths.rbegin(); it != lengths.rend(); ++it)
+            result.push_back(remaining += *it);
+        return result;
+    };
+
+    mini_adler32::ChunkerOptions options;
+    options.average_size = 4096;
+    const auto lengths = chunk(data, options);
+    std::size_t total = 0;
+    for(const auto length: lengths) {
+        total += length;
+        EXPECT_GE(length, 1024);
+        EXPECT_LE(length, 16384);
+    }
+    EXPECT_EQ(data.size(), total);
+    EXPECT_GT(lengths.size(), data.size() / 4096 / 2);
+    EXPECT_LT(lengths.size(), data.size() / 4096 * 2);
+
+    // Writing in pieces gives the same chunks
+    std::vector<std::size_t> streamed;
+    mini_adler32::Chunker chunker{options};
+    for(std::size_t n = 0; n < data.size(); n += 1000)
+        chunker.Write(data.begin() + n, data.begin() + std::min(n + 1000, data.size()), [&](std::size_t length) { streamed.push_back(length); });
+    chunker.Finish([&](std::size_t length) { streamed.push_back(length); });
+    EXPECT_EQ(lengths, streamed);
+
+    // Inserting bytes near the start leaves most later chunks intact
+    auto edited = data;
+    edited.insert(edited.begin() + 1000, { 'e', 'd', 'i', 't' });
+    const auto original_ends = boundariesFromEnd(lengths);
+    const auto edited_ends = boundariesFromEnd(chunk(edited, options));
+    std::size_t shared = 0;
+    for(const auto end: edited_ends)
+        shared += std::count(original_ends.begin(), original_ends.end(), end);
+    EXPECT_GE(shared + 3, original_ends.size());
+
+    // Constant input never matches, so max_size applies
+    options.max_size = 5000;
+    const std::vector<uint8_t> zeros(12000, 0);
+    EXPECT_EQ((std::vector<std::size_t>{ 5000, 5000, 2000 }), chunk(zeros, options));
+}
@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+#include "mini-crc32.h"
+#include "random-data.h"
+
+#include <list>
+
+namespace
+{
+    template<typename Container>
+    void Verify(const Container& input, mini_crc32::Value expected)
+    {
+        mini_crc32::CRC32 crc;
+        crc.Update(input.begin(), input.end());
+        EXPECT_EQ(expected, *crc);
+    }
+}
+
+TEST(CRC32, Empty)
+{
+    constexpr std::array<uint8_t, 0> data{};
+    Verify(data, mini_crc32::constants::initial_CRC32);
+}
+
+TEST(CRC32, Check)
+{
+    // The standard check value for CRC-32/ISO-HDLC
+    const std::string data{"123456789"};
+    Verify(data, 0xcbf43926);
+    // IEND chunk type, as found in every PNG file
+    const std::array<uint8_t, 4> iend{ 'I', 'E', 'N', 'D' };
+    Verify(iend, 0xae426082);
+}
+
+TEST(CRC32, Variants)
+{
+    std::vector<mini_crc32::detail::UpdateFn> variants{
+        mini_crc32::detail::UpdateSlicing8,
+        mini_crc32::detail::GetUpdateFn(),
+    };
+#if defined(MINI_CRC32_X86_SIMD)
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+        variants.push_back(mini_crc32::detail::UpdatePCLMUL);
+#endif
+
+    const auto data = MakeRandomData(10000, 1);
+
+    for(const std::size_t offset: { 0, 1, 7 }) {
+        for(const std::size_t length: { 0, 1, 7, 8, 15, 16, 63, 64, 65, 127, 128, 200, 4096, 9000 }) {
+            const auto expected = mini_crc32::detail::UpdateBytewise(0x12345678, data.data() + offset, length);
+            for(const auto fn: variants)
+                EXPECT_EQ(expected, fn(0x12345678, data.data() + offset, length)) << "offset " << offset << " length " << length;
+
+            // Non-contiguous input takes the generic path
+            const std::list<uint8_t> list(data.begin() + offset, data.begin() + offset + length);
+            Verify(list, mini_crc32::detail::UpdateBytewise(0, data.data() + offset, length));
+        }
+    }
+
+    // Contiguous, but neither pointers nor byte values: each bool counts as
+    // a byte of 0 or 1
+    constexpr std::array<uint8_t, 4> values{ 1, 0, 1, 1 };
+    const auto expected = mini_crc32::detail::UpdateBytewise(mini_crc32::constants::initial_CRC32, values.data(), values.size());
+    Verify(std::vector<bool>{ true, false, true, true }, expected);
+    Verify(std::vector<std::byte>{ std::byte{1}, std::byte{0}, std::byte{1}, std::byte{1} }, expected);
+}
+
+TEST(CRC32, Incremental)
+{
+    const std::string text(10000, 'x');
+    mini_crc32::CRC32 whole, pieces;
+    whole.Update(text.begin(), text.end());
+    for(std::size_t n = 0; n < text.size(); n += 333)
+        pieces.Update(text.begin() + n, text.begin() + std::min(n + 333, text.size()));
+    EXPECT_EQ(*whole, *pieces);
+}
+
+TEST(CRC32, Combine)
+{
+    const auto data = MakeRandomData(100000, 7);
+    mini_crc32::CRC32 whole;
+    whole.Update(data.begin(), data.end());
+
+    for(const std::size_t split: { std::size_t{0}, std::size_t{1}, std::size_t{4095}, std::size_t{70000}, data.size() }) {
+        mini_crc32::CRC32 a, b;
+        a.Update(data.begin(), data.begin() + split);
+        b.Update(data.begin() + split, data.end());
+        EXPECT_EQ(*whole, mini_crc32::Combine(*a, *b, data.size() - split));
+    }
+    static_assert(mini_crc32::Combine(0xcbf43926, 0, 0) == 0xcbf43926);
+
+    for(const unsigned int num_threads: { 1, 2, 3, 16 }) {
+        for(const std::size_t chunk_size: { 1, 1000, 4096, 1 << 20 })
+            EXPECT_EQ(*whole, mini_crc32::ChecksumParallel(data.data(), data.size(), num_threads, chunk_size));
+    }
+    EXPECT_EQ(mini_crc32::constants::initial_CRC32, mini_crc32::ChecksumParallel(data.data(), 0, 4));
+}
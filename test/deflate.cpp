@@ -1,26 +1,49 @@
 #include "gtest/gtest.h"
 #include "mini-deflate.h"
+#include "random-data.h"
 
 namespace
 {
     // Combines all decompressed data into output
-    template<typename Data> mini_deflate::Result DecompressInto(const Data& data, std::vector<uint8_t>& output)
+    template<typename Policy = mini_deflate::CheckedInput, typename Data> mini_deflate::Result DecompressInto(const Data& data, std::vector<uint8_t>& output)
     {
         mini_deflate::BitStreamer bs{data};
-        return mini_deflate::Decompress(bs, [&](const auto& v) {
+        return mini_deflate::Decompress<Policy>(bs, [&](const auto& v) {
             std::copy(v.begin(), v.end(), std::back_inserter(output));
         });
     }
 
-    // Decompresses data and compares with expected
+    // Decompresses data using both input policies and compares with expected
     template<typename Data, typename Expected> void VerifyDecompress(const Data& data, const Expected& expected)
     {
-        std::vector<uint8_t> output;
-        auto result = DecompressInto(data, output);
-        ASSERT_EQ(mini_deflate::Result::OK, result);
+        {
+            std::vector<uint8_t> output;
+            auto result = DecompressInto(data, output);
+            ASSERT_EQ(mini_deflate::Result::OK, result);
 
-        EXPECT_EQ(expected.size(), output.size());
-        EXPECT_EQ(expected, output);
+            EXPECT_EQ(expected.size(), output.size());
+            EXPECT_EQ(expected, output);
+        }
+        {
+            std::vector<uint8_t> output;
+            auto result = DecompressInto<mini_deflate::TrustedInput>(data, output);
+            ASSERT_EQ(mini_deflate::Result::OK, result);
+
+            EXPECT_EQ(expected.size(), output.size());
+            EXPECT_EQ(expected, output);
+        }
+        {
+            // Appended after existing content, without reallocating
+            std::vector<uint8_t> output{ 0x55 };
+            output.reserve(1 + expected.size());
+            const auto storage = output.data();
+            mini_deflate::BitStreamer bs{data};
+            ASSERT_EQ(mini_deflate::Result::OK, mini_deflate::DecompressAppend(bs, output));
+
+            EXPECT_EQ(storage, output.data());
+            EXPECT_EQ(0x55, output.front());
+            EXPECT_EQ(expected, std::vector<uint8_t>(output.begin() + 1, output.end()));
+        }
     }
 
     // Invokes 'extract' to extract values and compares them with expected
@@ -60,6 +83,38 @@ TEST(BitStreamer, GetBit)
     VerifyExtractedBits(data, expected, [](auto& bs) { return bs.GetBit(); });
 }
 
+TEST(BitStreamer, Streaming)
+{
+    struct Streamer
+    {
+        std::optional<uint8_t> GetByte()
+        {
+            if (pos >= data.size()) return {};
+            return data[pos++];
+        }
+
+        std::vector<uint8_t> data;
+        std::size_t pos = 0;
+    };
+
+    // Bytes are taken from the streamer as needed, never beyond the length
+    Streamer s{ { 0x12, 0x34, 0x5a, 0xff } };
+    mini_deflate::StreamingBitStreamer bs{s, 3};
+    EXPECT_EQ(0x2, bs.GetDataBits(4));
+    EXPECT_EQ(1, s.pos);
+    EXPECT_EQ(2, bs.Remaining());
+    EXPECT_EQ(0x341, bs.GetDataBits(12));
+    EXPECT_FALSE(bs.GetDataBits(9).has_value());
+    EXPECT_EQ(0, bs.Remaining());
+    EXPECT_EQ(3, s.pos);
+    EXPECT_FALSE(bs.Truncated());
+
+    Streamer short_s{ { 0x12 } };
+    mini_deflate::StreamingBitStreamer short_bs{short_s, 2};
+    EXPECT_FALSE(short_bs.GetDataBits(16).has_value());
+    EXPECT_TRUE(short_bs.Truncated());
+}
+
 TEST(BitStreamer, GetBits)
 {
     {
@@ -238,3 +293,724 @@ Notices
     }();
     VerifyDecompress(data, expected_output);
 }
+
+TEST(Deflate, Content_MultipleBlocks)
+{
+    // Two fixed huffman blocks separated by a sync flush; the second block
+    // refers back to data from the first
+    constexpr std::array<uint8_t, 78> data{
+        0x0a, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53,
+        0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28,
+        0x01, 0x4a, 0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0x0c, 0x0e, 0xc5,
+        0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x0b, 0x41, 0xe2, 0x29, 0x14, 0xe7, 0xa4, 0xa6, 0x16, 0x14,
+        0x5b, 0x83, 0x95, 0x60, 0x37, 0x21, 0x31, 0x3d, 0x31, 0x33, 0x8f, 0x5c, 0x5d, 0x00
+    };
+
+    const auto expected_output = []() {
+        std::vector<uint8_t> output;
+        const std::string a = "The quick brown fox jumps over the lazy dog. ";
+        const std::string b = "The lazy dog sleeps; the quick brown fox jumps again. ";
+        for (int n = 0; n < 4; n++) std::copy(a.begin(), a.end(), std::back_inserter(output));
+        for (int n = 0; n < 2; n++) std::copy(b.begin(), b.end(), std::back_inserter(output));
+        return output;
+    }();
+    VerifyDecompress(data, expected_output);
+}
+
+TEST(Deflate, TrustedInput_Truncated)
+{
+    // Truncated input must terminate without reading past the buffer
+    constexpr std::array<uint8_t, 5> data{ 0xcb, 0x48, 0xcd, 0xc9, 0xc9 };
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::EndOfStream, DecompressInto<mini_deflate::TrustedInput>(data, output));
+}
+
+TEST(Deflate, OvershootingCodeLengths)
+{
+    // Dynamic block with HDIST = 32 whose final code 16 repeats past the
+    // end of the code lengths, giving distance symbols 32 and 33 a code
+    constexpr std::array<uint8_t, 14> data{
+        0x0d, 0xdf, 0x05, 0x01, 0x00, 0x00, 0x00, 0x80, 0xa0, 0xff, 0xaf, 0xe1, 0x89, 0x31
+    };
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::InvalidDynamicReference, DecompressInto(data, output));
+    EXPECT_EQ(mini_deflate::Result::InvalidDynamicReference, DecompressInto<mini_deflate::TrustedInput>(data, output));
+}
+
+TEST(Deflate, CorruptDistance)
+{
+    // Fixed huffman block which starts with a back-reference
+    constexpr std::array<uint8_t, 3> data{ 0x03, 0x02, 0x00 };
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::CorruptDistance, DecompressInto(data, output));
+
+    // Nor may it reach into what the output held before
+    output = { 'a' };
+    mini_deflate::BitStreamer bs{data};
+    EXPECT_EQ(mini_deflate::Result::CorruptDistance, mini_deflate::DecompressAppend(bs, output));
+}
+
+namespace
+{
+    // Compresses data and combines all output
+    template<typename Data> std::vector<uint8_t> CompressToVector(const Data& data, const mini_deflate::CompressOptions& options)
+    {
+        std::vector<uint8_t> output;
+        auto result = mini_deflate::Compress(data, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }, options);
+        EXPECT_EQ(mini_deflate::Result::OK, result);
+        return output;
+    }
+
+    // Compresses data and verifies Decompress() yields it again
+    template<typename Data> std::vector<uint8_t> VerifyRoundTrip(const Data& data, const mini_deflate::CompressOptions& options)
+    {
+        const auto compressed = CompressToVector(data, options);
+        const std::vector<uint8_t> expected(data.begin(), data.end());
+        std::vector<uint8_t> output;
+        EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(compressed, output));
+        EXPECT_EQ(expected.size(), output.size());
+        EXPECT_TRUE(expected == output);
+        return compressed;
+    }
+
+    // Text-like data with plenty of repeats, mixed with some noise
+    std::vector<uint8_t> MakeCompressibleData(std::size_t length)
+    {
+        const std::array<const char*, 8> words{ "deflate ", "huffman ", "window ", "literal ", "distance ", "length ", "block ", "stream " };
+        std::vector<uint8_t> data;
+        Random random{12345};
+        while(data.size() < length) {
+            if (random() % 16 == 0) {
+                data.push_back(random() & 0xff);
+                continue;
+            }
+            for(const char* s = words[random() % words.size()]; *s != '\0'; s++) data.push_back(*s);
+        }
+        data.resize(length);
+        return data;
+    }
+
+    // Image rows which mostly repeat the row above, with a few pixels changed
+    std::vector<uint8_t> MakeRepeatingRows(std::size_t stride, std::size_t rows)
+    {
+        Random random{777};
+        std::vector<uint8_t> data(stride);
+        for(auto& v: data) v = random() & 0xff;
+        for(std::size_t row = 1; row < rows; row++) {
+            data.insert(data.end(), data.end() - stride, data.end());
+            for(int n = 0; n < 4; n++)
+                data[data.size() - stride + random() % stride] = random() & 0xff;
+        }
+        return data;
+    }
+
+    // Resembles filtered image rows: a filter type byte followed by small
+    // differences, with runs of unchanged pixels
+    std::vector<uint8_t> MakeScanlineData(std::size_t stride, std::size_t rows)
+    {
+        std::vector<uint8_t> data;
+        Random random{4321};
+        for(std::size_t row = 0; row < rows; row++) {
+            data.push_back(1);
+            while(data.size() % stride != 0) {
+                if (random() % 4 == 0) {
+                    for(auto n = random() % 32; n > 0 && data.size() % stride != 0; n--) data.push_back(0);
+                    continue;
+                }
+                data.push_back(static_cast<uint8_t>(random() % 7 - 3));
+            }
+        }
+        return data;
+    }
+}
+
+TEST(Compress, InvalidLevel)
+{
+    const std::vector<uint8_t> data{ 1, 2, 3 };
+    mini_deflate::CompressOptions options;
+    options.level = 11;
+    EXPECT_EQ(mini_deflate::Result::InvalidLevel, mini_deflate::Compress(data, [](const auto&) { }, options));
+}
+
+TEST(Compress, Empty)
+{
+    const std::vector<uint8_t> data;
+    for(int level = 0; level <= 10; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        VerifyRoundTrip(data, options);
+    }
+}
+
+TEST(Compress, HelloWorld)
+{
+    const std::string data = "hello world";
+    for(int level = 0; level <= 10; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        VerifyRoundTrip(data, options);
+    }
+}
+
+TEST(Compress, AllLevels)
+{
+    const auto data = MakeCompressibleData(150000);
+    std::size_t stored_size = 0, fastest_size = 0, best_size = 0;
+    for(int level = 0; level <= 9; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        const auto size = VerifyRoundTrip(data, options).size();
+        if (level == mini_deflate::constants::level_Store) stored_size = size;
+        if (level == mini_deflate::constants::level_Fastest) fastest_size = size;
+        if (level == mini_deflate::constants::level_Best) best_size = size;
+    }
+    EXPECT_GT(stored_size, data.size());
+    EXPECT_LT(fastest_size, data.size() / 2);
+    EXPECT_LE(best_size, fastest_size);
+}
+
+TEST(Compress, Incompressible)
+{
+    const auto data = MakeRandomData(100000, 1);
+    const auto compressed = VerifyRoundTrip(data, mini_deflate::CompressOptions{});
+    // Stored blocks add only a few bytes of overhead
+    EXPECT_LT(compressed.size(), data.size() + 64);
+}
+
+TEST(Compress, IncompressibleDetection)
+{
+    const auto random = MakeRandomData(16384, 1);
+    EXPECT_TRUE(mini_deflate::detail::LooksIncompressible(random.data(), random.size()));
+
+    const auto text = MakeCompressibleData(16384);
+    EXPECT_FALSE(mini_deflate::detail::LooksIncompressible(text.data(), text.size()));
+
+    // Uniformly distributed, but repeating
+    std::vector<uint8_t> repeats;
+    for(int n = 0; n < 8; n++) repeats.insert(repeats.end(), random.begin(), random.begin() + 2048);
+    EXPECT_FALSE(mini_deflate::detail::HasRepeats(random.data(), random.data(), random.data() + random.size()));
+    EXPECT_TRUE(mini_deflate::detail::HasRepeats(repeats.data(), repeats.data(), repeats.data() + repeats.size()));
+    for(int level = mini_deflate::constants::level_Fastest; level <= mini_deflate::constants::level_Max; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        EXPECT_LT(VerifyRoundTrip(repeats, options).size(), repeats.size() / 4);
+    }
+
+    // Incompressible by itself, but repeating within the window
+    std::vector<uint8_t> repeated_random;
+    for(int n = 0; n < 4; n++) repeated_random.insert(repeated_random.end(), random.begin(), random.end());
+    EXPECT_TRUE(mini_deflate::detail::HasRepeats(repeated_random.data(), repeated_random.data() + random.size(), repeated_random.data() + 2 * random.size()));
+    for(int level = mini_deflate::constants::level_Fastest; level <= mini_deflate::constants::level_Max; level++) {
+        for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            EXPECT_LT(VerifyRoundTrip(repeated_random, options).size(), random.size() + random.size() / 16);
+        }
+    }
+
+    // Stored segments between compressed ones
+    std::vector<uint8_t> mixed(text.begin(), text.end());
+    mixed.insert(mixed.end(), random.begin(), random.end());
+    mixed.insert(mixed.end(), text.begin(), text.end());
+    for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest }) {
+        mini_deflate::CompressOptions options;
+        options.strategy = strategy;
+        EXPECT_LT(VerifyRoundTrip(mixed, options).size(), random.size() + text.size() / 2);
+    }
+}
+
+TEST(Compress, LongRuns)
+{
+    std::vector<uint8_t> data(300000, 'a');
+    std::fill(data.begin() + 100000, data.begin() + 200000, 'b');
+    for(int level = 1; level <= 9; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        const auto compressed = VerifyRoundTrip(data, options);
+        EXPECT_LT(compressed.size(), 2000);
+    }
+}
+
+TEST(Compress, Fastest)
+{
+    mini_deflate::CompressOptions options;
+    options.strategy = mini_deflate::Strategy::Fastest;
+    VerifyRoundTrip(std::string{}, options);
+    VerifyRoundTrip(std::string{"abc"}, options);
+
+    const auto data = MakeCompressibleData(150000);
+    const auto compressed = VerifyRoundTrip(data, options);
+    EXPECT_LT(compressed.size(), data.size() / 2);
+
+    std::vector<uint8_t> runs(100000, 'x');
+    EXPECT_LT(VerifyRoundTrip(runs, options).size(), 2000);
+}
+
+TEST(Compress, LengthLimitedCodes)
+{
+    // Fibonacci frequencies yield a maximally skewed tree, which would need
+    // codes far longer than 15 bits when left unconstrained
+    std::vector<uint32_t> freqs(30);
+    freqs[0] = freqs[1] = 1;
+    for(std::size_t n = 2; n < freqs.size(); n++) freqs[n] = freqs[n - 1] + freqs[n - 2];
+
+    const auto lengths = mini_deflate::detail::BuildHuffmanLengths(freqs, mini_deflate::detail::MAX_BITS);
+    double kraft = 0;
+    for(auto l: lengths) {
+        EXPECT_GE(l, 1);
+        EXPECT_LE(l, mini_deflate::detail::MAX_BITS);
+        kraft += std::ldexp(1.0, -l);
+    }
+    EXPECT_DOUBLE_EQ(1.0, kraft);
+
+    // Symbols whose frequencies follow a Fibonacci sequence
+    std::vector<uint8_t> data;
+    uint32_t a = 1, b = 1;
+    for(int symbol = 0; symbol < 24; symbol++) {
+        for(uint32_t n = 0; n < a; n++) data.push_back(static_cast<uint8_t>(symbol * 7));
+        std::swap(a, b);
+        b += a;
+    }
+    std::rotate(data.begin(), data.begin() + data.size() / 3, data.end());
+    VerifyRoundTrip(data, mini_deflate::CompressOptions{});
+}
+
+TEST(Compress, ChangingStatistics)
+{
+    // Text followed by a different alphabet benefits from separate blocks
+    auto data = MakeCompressibleData(20000);
+    Random random{7};
+    for(int n = 0; n < 20000; n++)
+        data.push_back(0x80 + (random() & 0x0f));
+    const auto compressed = VerifyRoundTrip(data, mini_deflate::CompressOptions{});
+    EXPECT_LT(compressed.size(), 20000);
+}
+
+TEST(Compress, OptimalParsing)
+{
+    const auto data = MakeCompressibleData(50000);
+    mini_deflate::CompressOptions options;
+    options.level = mini_deflate::constants::level_Best;
+    const auto best_size = VerifyRoundTrip(data, options).size();
+    options.level = mini_deflate::constants::level_Max;
+    const auto max_size = VerifyRoundTrip(data, options).size();
+    EXPECT_LT(max_size, best_size);
+
+    std::vector<uint8_t> runs(20000, 'a');
+    VerifyRoundTrip(runs, options);
+}
+
+namespace
+{
+    template<typename Data> std::vector<uint8_t> WriteToVector(mini_deflate::Deflater& deflater, const Data& data, mini_deflate::Flush flush)
+    {
+        std::vector<uint8_t> output;
+        auto result = deflater.Write(data, flush, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        });
+        EXPECT_EQ(mini_deflate::Result::OK, result);
+        return output;
+    }
+}
+
+TEST(Deflater, SyncFlush)
+{
+    const auto data = MakeCompressibleData(30000);
+    const std::vector<uint8_t> message1(data.begin(), data.begin() + 10000);
+    const std::vector<uint8_t> message2(data.begin() + 10000, data.end());
+
+    mini_deflate::Deflater deflater;
+    auto stream = WriteToVector(deflater, message1, mini_deflate::Flush::Sync);
+    // A sync flush ends with an empty stored block
+    ASSERT_GE(stream.size(), 4);
+    EXPECT_EQ((std::vector<uint8_t>{ 0x00, 0x00, 0xff, 0xff }), std::vector<uint8_t>(stream.end() - 4, stream.end()));
+
+    // Everything written so far is decodable, even though the stream has not
+    // ended yet
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::EndOfStream, DecompressInto(stream, output));
+    EXPECT_TRUE(message1 == output);
+
+    const auto tail = WriteToVector(deflater, message2, mini_deflate::Flush::Sync);
+    stream.insert(stream.end(), tail.begin(), tail.end());
+    output.clear();
+    EXPECT_EQ(mini_deflate::Result::EndOfStream, DecompressInto(stream, output));
+    EXPECT_TRUE(data == output);
+
+    const auto end = WriteToVector(deflater, std::vector<uint8_t>{}, mini_deflate::Flush::Finish);
+    stream.insert(stream.end(), end.begin(), end.end());
+    output.clear();
+    EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(stream, output));
+    EXPECT_TRUE(data == output);
+
+    EXPECT_EQ(mini_deflate::Result::StreamFinished, deflater.Write(data, mini_deflate::Flush::None, [](const auto&) { }));
+}
+
+TEST(Deflater, FullFlush)
+{
+    const auto data = MakeCompressibleData(30000);
+    const std::vector<uint8_t> message1(data.begin(), data.begin() + 15000);
+    const std::vector<uint8_t> message2(data.begin() + 15000, data.end());
+
+    for(int level = 0; level <= mini_deflate::constants::level_Best; level++) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        mini_deflate::Deflater deflater{options};
+        const auto head = WriteToVector(deflater, message1, mini_deflate::Flush::Full);
+        const auto tail = WriteToVector(deflater, message2, mini_deflate::Flush::Finish);
+
+        // Output after a full flush does not depend on what came before
+        std::vector<uint8_t> output;
+        EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(tail, output));
+        EXPECT_TRUE(message2 == output);
+    }
+}
+
+TEST(Deflater, SmallWrites)
+{
+    const auto data = MakeCompressibleData(20000);
+    mini_deflate::Deflater deflater;
+    std::vector<uint8_t> stream;
+    for(std::size_t n = 0; n < data.size(); n += 100) {
+        const std::vector<uint8_t> piece(data.begin() + n, data.begin() + std::min(n + 100, data.size()));
+        const auto output = WriteToVector(deflater, piece, mini_deflate::Flush::None);
+        stream.insert(stream.end(), output.begin(), output.end());
+    }
+    const auto end = WriteToVector(deflater, std::vector<uint8_t>{}, mini_deflate::Flush::Finish);
+    stream.insert(stream.end(), end.begin(), end.end());
+
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(stream, output));
+    EXPECT_TRUE(data == output);
+}
+
+TEST(Compress, Parallel)
+{
+    const auto data = MakeCompressibleData(300000);
+    auto compressParallel = [&](unsigned int num_threads) {
+        std::vector<uint8_t> output;
+        auto result = mini_deflate::CompressParallel(data, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }, mini_deflate::CompressOptions{}, num_threads, 64 * 1024);
+        EXPECT_EQ(mini_deflate::Result::OK, result);
+        return output;
+    };
+
+    const auto single = compressParallel(1);
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(single, output));
+    EXPECT_TRUE(data == output);
+
+    // Output does not depend on the number of threads used
+    EXPECT_TRUE(single == compressParallel(3));
+    EXPECT_TRUE(single == compressParallel(8));
+
+    // Priming each chunk with the preceding window keeps the ratio close to
+    // that of a single stream
+    EXPECT_LT(single.size(), CompressToVector(data, mini_deflate::CompressOptions{}).size() * 102 / 100);
+}
+
+TEST(Compress, ParallelIgnoresTargetThroughput)
+{
+    const auto data = MakeCompressibleData(300000);
+    auto compressParallel = [&](const mini_deflate::CompressOptions& options, unsigned int num_threads) {
+        std::vector<uint8_t> output;
+        EXPECT_EQ(mini_deflate::Result::OK, mini_deflate::CompressParallel(data, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }, options, num_threads, 32 * 1024));
+        return output;
+    };
+
+    // An unreachable target would otherwise drop to storing the data as
+    // soon as the controller measures; the output must remain as without it
+    mini_deflate::CompressOptions options;
+    options.level = mini_deflate::constants::level_Fastest;
+    const auto expected = compressParallel(options, 1);
+    options.target_mb_per_second = 1e12;
+    EXPECT_TRUE(expected == compressParallel(options, 1));
+    EXPECT_TRUE(expected == compressParallel(options, 4));
+}
+
+TEST(Compress, ParallelStrategies)
+{
+    const auto data = MakeCompressibleData(100000);
+    for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest, mini_deflate::Strategy::Filtered,
+                               mini_deflate::Strategy::Rle, mini_deflate::Strategy::HuffmanOnly, mini_deflate::Strategy::Rows }) {
+        for(const int level: { mini_deflate::constants::level_Store, mini_deflate::constants::level_Default }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            std::vector<uint8_t> compressed;
+            EXPECT_EQ(mini_deflate::Result::OK, mini_deflate::CompressParallel(data, [&](const auto& v) {
+                std::copy(v.begin(), v.end(), std::back_inserter(compressed));
+            }, options, 2, 32 * 1024));
+            VerifyDecompress(compressed, data);
+        }
+    }
+}
+
+TEST(Compress, ParallelSmall)
+{
+    for(const auto& data: { std::string{}, std::string{"hello world"} }) {
+        std::vector<uint8_t> compressed;
+        EXPECT_EQ(mini_deflate::Result::OK, mini_deflate::CompressParallel(data, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(compressed));
+        }));
+        VerifyDecompress(compressed, std::vector<uint8_t>(data.begin(), data.end()));
+    }
+}
+
+TEST(Compress, MatchLength)
+{
+    std::vector<mini_deflate::detail::MatchLengthFn> variants{
+        mini_deflate::detail::MatchLengthScalar,
+        mini_deflate::detail::GetMatchLengthFn(),
+    };
+#if defined(MINI_DEFLATE_X86_SIMD)
+    variants.push_back(mini_deflate::detail::MatchLengthSSE2);
+    if (__builtin_cpu_supports("avx2"))
+        variants.push_back(mini_deflate::detail::MatchLengthAVX2);
+#endif
+
+    const auto a = MakeCompressibleData(300);
+    for(int max_length = 0; max_length <= 258; max_length += 7) {
+        for(int mismatch = 0; mismatch <= max_length; ++mismatch) {
+            auto b = a;
+            if (mismatch < static_cast<int>(b.size()))
+                b[mismatch] ^= 0x80;
+            const auto expected = mini_deflate::detail::MatchLengthBytewise(a.data(), b.data(), max_length);
+            ASSERT_EQ(std::min(mismatch, max_length), expected);
+            for(const auto fn: variants)
+                ASSERT_EQ(expected, fn(a.data(), b.data(), max_length));
+        }
+    }
+}
+
+TEST(Compress, Strategies)
+{
+    const auto text = MakeCompressibleData(50000);
+    const auto image = MakeScanlineData(301, 200);
+    for(const auto strategy: { mini_deflate::Strategy::Filtered, mini_deflate::Strategy::Rle, mini_deflate::Strategy::HuffmanOnly }) {
+        for(int level = 0; level <= mini_deflate::constants::level_Max; level++) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            VerifyRoundTrip(text, options);
+            const auto compressed = VerifyRoundTrip(image, options);
+            if (level == mini_deflate::constants::level_Store)
+                EXPECT_GT(compressed.size(), image.size());
+            else
+                EXPECT_LT(compressed.size(), image.size() / 2);
+        }
+    }
+}
+
+TEST(Compress, RleAndHuffmanOnly)
+{
+    const std::vector<uint8_t> zeros(100000, 0);
+    mini_deflate::CompressOptions options;
+    options.strategy = mini_deflate::Strategy::Rle;
+    EXPECT_LT(VerifyRoundTrip(zeros, options).size(), 1000);
+
+    // Every literal takes at least a bit
+    options.strategy = mini_deflate::Strategy::HuffmanOnly;
+    EXPECT_GE(VerifyRoundTrip(zeros, options).size(), zeros.size() / 8);
+
+    // Runs do not continue across a full flush
+    options.strategy = mini_deflate::Strategy::Rle;
+    mini_deflate::Deflater deflater{options};
+    WriteToVector(deflater, std::vector<uint8_t>(100, 'a'), mini_deflate::Flush::Full);
+    const auto tail = WriteToVector(deflater, std::vector<uint8_t>(100, 'a'), mini_deflate::Flush::Finish);
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_deflate::Result::OK, DecompressInto(tail, output));
+    EXPECT_TRUE(std::vector<uint8_t>(100, 'a') == output);
+}
+
+TEST(Compress, RowStride)
+{
+    constexpr std::size_t stride = 3 * 400 + 1;
+    const auto data = MakeRepeatingRows(stride, 150);
+
+    mini_deflate::CompressOptions options;
+    options.strategy = mini_deflate::Strategy::Rle;
+    const auto rle = VerifyRoundTrip(data, options).size();
+
+    // Probing just the row above finds nearly all repeats
+    options.strategy = mini_deflate::Strategy::Rows;
+    options.row_stride = stride;
+    options.pixel_stride = 3;
+    const auto rows = VerifyRoundTrip(data, options).size();
+    EXPECT_LT(rows * 10, rle);
+
+    for(int level = mini_deflate::constants::level_Fastest; level <= mini_deflate::constants::level_Best; level++) {
+        options.strategy = mini_deflate::Strategy::Default;
+        options.level = level;
+        EXPECT_LT(VerifyRoundTrip(data, options).size(), rows * 11 / 10);
+    }
+
+    // Without a stride, Rows only looks for runs
+    options = mini_deflate::CompressOptions{};
+    options.strategy = mini_deflate::Strategy::Rows;
+    EXPECT_EQ(rle, VerifyRoundTrip(data, options).size());
+}
+
+TEST(Deflater, Reset)
+{
+    const auto data = MakeCompressibleData(20000);
+    for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest, mini_deflate::Strategy::Rle }) {
+        for(const int level: { 1, 6, 9 }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            mini_deflate::Deflater deflater{options};
+            for(std::size_t length: { 1000, 4000, 0, 20000, 3000 }) {
+                // A reset deflater behaves exactly like a new one
+                const std::vector<uint8_t> message(data.begin() + (20000 - length) / 2, data.begin() + (20000 + length) / 2);
+                deflater.Reset();
+                EXPECT_TRUE(CompressToVector(message, options) == WriteToVector(deflater, message, mini_deflate::Flush::Finish));
+            }
+        }
+    }
+}
+
+TEST(Deflater, ManyResets)
+{
+    // Enough resets to have the stream positions wrap around
+    const auto data = MakeCompressibleData(4000);
+    mini_deflate::CompressOptions options;
+    options.level = 1;
+    mini_deflate::Deflater deflater{options};
+    for(int n = 0; n < 70000; n++) {
+        deflater.Reset();
+        WriteToVector(deflater, std::vector<uint8_t>{}, mini_deflate::Flush::Finish);
+    }
+    deflater.Reset();
+    EXPECT_TRUE(CompressToVector(data, options) == WriteToVector(deflater, data, mini_deflate::Flush::Finish));
+}
+
+TEST(Compress, TargetThroughput)
+{
+    const auto data = MakeCompressibleData(300000);
+    mini_deflate::CompressOptions fastest;
+    fastest.strategy = mini_deflate::Strategy::Fastest;
+    const auto fastest_size = VerifyRoundTrip(data, fastest).size();
+
+    // An unreachable target drops to storing the data
+    auto options = fastest;
+    options.target_mb_per_second = 1e12;
+    EXPECT_GT(VerifyRoundTrip(data, options).size(), data.size() * 3 / 4);
+
+    // A target which is always met moves towards better compression
+    options.target_mb_per_second = 1e-6;
+    EXPECT_LT(VerifyRoundTrip(data, options).size(), fastest_size);
+
+    // Reasonable targets work for all data
+    for(const double target: { 1.0, 20.0, 100.0 }) {
+        mini_deflate::CompressOptions options;
+        options.target_mb_per_second = target;
+        VerifyRoundTrip(data, options);
+    }
+}
+
+TEST(Compress, MemoryOptions)
+{
+    for(const auto& [window_bits, hash_bits, chain_bits]: std::vector<std::array<int, 3>>{ { 8, 15, 0 }, { 16, 15, 0 }, { 15, 7, 0 }, { 15, 17, 0 }, { 12, 12, 7 }, { 12, 12, 13 } }) {
+        mini_deflate::CompressOptions options;
+        options.window_bits = window_bits;
+        options.hash_bits = hash_bits;
+        options.chain_bits = chain_bits;
+        EXPECT_EQ(mini_deflate::Result::InvalidMemoryOptions, mini_deflate::Compress(std::string{"x"}, [](const auto&) { }, options));
+    }
+
+    // Repeats at a distance of 1000 bytes only fit in windows of 1 KiB or more
+    const auto block = MakeRandomData(1000, 1);
+    std::vector<uint8_t> data;
+    for(int n = 0; n < 20; n++) data.insert(data.end(), block.begin(), block.end());
+
+    std::size_t previous_usage = 0;
+    for(int window_bits = 9; window_bits <= 15; window_bits++) {
+        for(const int level: { 1, 6, 9 }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.window_bits = window_bits;
+            options.hash_bits = std::max(window_bits - 1, 8);
+            const auto size = VerifyRoundTrip(data, options).size();
+            if (window_bits == 9)
+                EXPECT_GT(size, data.size() * 9 / 10);
+            else
+                EXPECT_LT(size, data.size() / 4);
+            VerifyRoundTrip(MakeCompressibleData(100000), options);
+
+            const auto usage = mini_deflate::EncoderMemoryUsage(options);
+            EXPECT_EQ(usage, mini_deflate::Deflater{options}.MemoryUsage());
+            if (level == 1) {
+                EXPECT_GT(usage, previous_usage);
+                previous_usage = usage;
+            }
+        }
+    }
+
+    mini_deflate::CompressOptions small;
+    small.window_bits = 9;
+    small.hash_bits = 8;
+    EXPECT_LT(mini_deflate::EncoderMemoryUsage(small), 24 * 1024);
+}
+
+TEST(Deflater, Dictionary)
+{
+    const auto data = MakeCompressibleData(40000);
+    const std::vector<uint8_t> dictionary(data.begin(), data.begin() + 35000);
+    const std::vector<uint8_t> message(data.begin() + 35000, data.end());
+
+    mini_deflate::Deflater deflater;
+    deflater.SetDictionary(dictionary.begin(), dictionary.end());
+    const auto compressed = WriteToVector(deflater, message, mini_deflate::Flush::Finish);
+    EXPECT_LT(compressed.size(), CompressToVector(message, mini_deflate::CompressOptions{}).size());
+
+    auto decompress = [&](auto policy) {
+        std::vector<uint8_t> output;
+        mini_deflate::BitStreamer bs{compressed};
+        EXPECT_EQ(mini_deflate::Result::OK, mini_deflate::Decompress<decltype(policy)>(bs, dictionary, [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }));
+        return output;
+    };
+    EXPECT_TRUE(message == decompress(mini_deflate::CheckedInput{}));
+    EXPECT_TRUE(message == decompress(mini_deflate::TrustedInput{}));
+}
+
+TEST(Deflater, DictionaryStrategies)
+{
+    const auto dictionary = MakeRandomData(35000, 7);
+    // A verbatim copy of part of the random dictionary, which only a primed
+    // hash table can encode as a few long matches
+    const std::vector<uint8_t> message(dictionary.begin() + 10000, dictionary.begin() + 13000);
+
+    for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest, mini_deflate::Strategy::Filtered,
+                               mini_deflate::Strategy::Rle, mini_deflate::Strategy::HuffmanOnly, mini_deflate::Strategy::Rows }) {
+        for(const int level: { mini_deflate::constants::level_Store, mini_deflate::constants::level_Fastest, mini_deflate::constants::level_Max }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            mini_deflate::Deflater deflater{options};
+            deflater.SetDictionary(dictionary.begin(), dictionary.end());
+            const auto compressed = WriteToVector(deflater, message, mini_deflate::Flush::Finish);
+
+            std::vector<uint8_t> output;
+            mini_deflate::BitStreamer bs{compressed};
+            EXPECT_EQ(mini_deflate::Result::OK, mini_deflate::Decompress(bs, dictionary, [&](const auto& v) {
+                std::copy(v.begin(), v.end(), std::back_inserter(output));
+            }));
+            EXPECT_TRUE(message == output);
+
+            const bool hashed = level != mini_deflate::constants::level_Store &&
+                (strategy == mini_deflate::Strategy::Default || strategy == mini_deflate::Strategy::Fastest || strategy == mini_deflate::Strategy::Filtered);
+            if (hashed) {
+                EXPECT_LT(compressed.size(), 100);
+            }
+        }
+    }
+}
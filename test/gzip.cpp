@@ -0,0 +1,186 @@
+#include "gtest/gtest.h"
+#include "mini-gzip.h"
+
+namespace
+{
+    template<typename T>
+    struct MemoryStreamer
+    {
+        MemoryStreamer(const T& data) : data(data) { }
+
+        std::optional<std::uint8_t> GetByte()
+        {
+            if (pos >= data.size()) return {};
+            return data[pos++];
+        }
+
+        void Skip(std::size_t n)
+        {
+            pos += n;
+        }
+
+        const T& data;
+        std::size_t pos{};
+    };
+
+    // Decompresses data through both the streaming and the buffer interface,
+    // which must agree
+    template<typename Data>
+    std::pair<mini_gzip::Result, std::string> Decompress(const Data& data, mini_gzip::Header* header = nullptr)
+    {
+        std::string streamed;
+        MemoryStreamer s{data};
+        const auto result = mini_gzip::Decompress(s, [&](const auto& v) {
+            streamed.insert(streamed.end(), v.begin(), v.end());
+        }, header);
+
+        std::vector<uint8_t> buffered;
+        EXPECT_EQ(result, mini_gzip::DecompressBuffer(data, buffered));
+        if (result == mini_gzip::Result::OK) {
+            EXPECT_EQ(streamed, std::string(buffered.begin(), buffered.end()));
+        }
+        return { result, streamed };
+    }
+
+    template<typename Data, typename... Args>
+    std::vector<uint8_t> CompressToVector(const Data& data, Args&&... args)
+    {
+        std::vector<uint8_t> compressed;
+        EXPECT_EQ(mini_gzip::Result::OK, mini_gzip::Compress(data, [&](const auto& v) {
+            compressed.insert(compressed.end(), v.begin(), v.end());
+        }, std::forward<Args>(args)...));
+        return compressed;
+    }
+
+    // Written with Python's zlib, using all optional header fields
+    constexpr std::array<uint8_t, 100> content_AllFields{
+        0x1f, 0x8b, 0x08, 0x1e, 0x00, 0x10, 0x5e, 0x5f, 0x02, 0x03, 0x06, 0x00,
+        0x41, 0x42, 0x02, 0x00, 0x68, 0x69, 0x6c, 0x6f, 0x67, 0x2e, 0x74, 0x78,
+        0x74, 0x00, 0x65, 0x78, 0x70, 0x6f, 0x72, 0x74, 0x65, 0x64, 0x00, 0xe1,
+        0x39, 0xcb, 0xcd, 0xcc, 0xcb, 0xd4, 0x4d, 0xaf, 0xca, 0x2c, 0x50, 0x28,
+        0x4a, 0x4d, 0x4c, 0x29, 0x56, 0x00, 0x33, 0x73, 0x53, 0x73, 0x93, 0x52,
+        0x8b, 0x8a, 0x15, 0xca, 0x8b, 0x32, 0x4b, 0x4a, 0x52, 0xf3, 0x14, 0x92,
+        0x2a, 0x15, 0xf2, 0x4b, 0x32, 0x52, 0x8b, 0x14, 0x4a, 0xf2, 0xf3, 0x73,
+        0x8a, 0xf5, 0xb8, 0x72, 0xe9, 0xa6, 0x09, 0x00, 0xf6, 0x82, 0x5c, 0x3e,
+        0x9f, 0x00, 0x00, 0x00
+    };
+}
+
+TEST(gzip, Content_AllFields)
+{
+    std::string expected;
+    for(int n = 0; n < 3; n++) expected += "mini-gzip reads gzip members written by other tools.\n";
+
+    mini_gzip::Header header;
+    EXPECT_EQ(std::make_pair(mini_gzip::Result::OK, expected), Decompress(content_AllFields, &header));
+    EXPECT_FALSE(header.text);
+    EXPECT_EQ(1600000000, header.modificationTime);
+    EXPECT_EQ(mini_gzip::constants::extraFlags_Best, header.extraFlags);
+    EXPECT_EQ(3, header.os);
+    EXPECT_EQ((std::vector<uint8_t>{ 'A', 'B', 2, 0, 'h', 'i' }), header.extra);
+    EXPECT_EQ(std::optional<std::string>{"log.txt"}, header.name);
+    EXPECT_EQ(std::optional<std::string>{"exported"}, header.comment);
+    EXPECT_TRUE(header.headerChecksum);
+}
+
+TEST(gzip, Errors)
+{
+    using mini_gzip::Result;
+    const std::vector<uint8_t> valid(content_AllFields.begin(), content_AllFields.end());
+    auto modify = [&](std::size_t offset, uint8_t x) {
+        auto data = valid;
+        data[offset] ^= x;
+        return Decompress(data).first;
+    };
+    EXPECT_EQ(Result::BadSignature, modify(1, 0xff));
+    EXPECT_EQ(Result::UnsupportedCompressionMethod, modify(2, 0x01));
+    EXPECT_EQ(Result::ReservedFlagsSet, modify(3, 0x80));
+    EXPECT_EQ(Result::HeaderChecksumError, modify(20, 0x01));
+    EXPECT_EQ(Result::ChecksumError, modify(valid.size() - 8, 0x01));
+    EXPECT_EQ(Result::SizeError, modify(valid.size() - 4, 0x01));
+
+    EXPECT_EQ(Result::PrematureEndOfStream, Decompress(std::vector<uint8_t>{}).first);
+    for(const std::size_t length: { 5, 30, 60, 96 })
+        EXPECT_EQ(Result::PrematureEndOfStream, Decompress(std::vector<uint8_t>(valid.begin(), valid.begin() + length)).first) << length;
+}
+
+TEST(gzip, Compress)
+{
+    std::string text;
+    for(int n = 0; n < 5000; n++) text += std::to_string(n % 97) + " ";
+
+    mini_gzip::Header header;
+    header.text = true;
+    header.modificationTime = 12345678;
+    header.extra = std::vector<uint8_t>{ 'x', 'y', 0, 0 };
+    header.name = "numbers.txt";
+    header.comment = "written by mini-gzip";
+    header.headerChecksum = true;
+    for(const int level: { 0, 1, 6, 9 }) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        const auto compressed = CompressToVector(text, options, header);
+        mini_gzip::Header decoded;
+        EXPECT_EQ(std::make_pair(mini_gzip::Result::OK, text), Decompress(compressed, &decoded));
+        EXPECT_EQ(header.text, decoded.text);
+        EXPECT_EQ(header.modificationTime, decoded.modificationTime);
+        EXPECT_EQ(header.extra, decoded.extra);
+        EXPECT_EQ(header.name, decoded.name);
+        EXPECT_EQ(header.comment, decoded.comment);
+        EXPECT_TRUE(decoded.headerChecksum);
+    }
+
+    // Without optional fields, the header is the minimal ten bytes
+    const auto plain = CompressToVector(text);
+    EXPECT_EQ(0, plain[3]);
+    EXPECT_EQ(std::make_pair(mini_gzip::Result::OK, text), Decompress(plain));
+
+    header.name = std::string("a\0b", 3);
+    EXPECT_EQ(mini_gzip::Result::InvalidHeader, mini_gzip::Compress(text, [](const auto&) { }, {}, header));
+    mini_deflate::CompressOptions options;
+    options.level = 11;
+    EXPECT_EQ(mini_gzip::Result::InvalidOptions, mini_gzip::Compress(text, [](const auto&) { }, options));
+}
+
+TEST(gzip, MultipleMembers)
+{
+    const std::string first{"first member\n"}, second{"second member\n"};
+    auto compressed = CompressToVector(first);
+    const auto more = CompressToVector(second);
+    compressed.insert(compressed.end(), more.begin(), more.end());
+    EXPECT_EQ(std::make_pair(mini_gzip::Result::OK, first + second), Decompress(compressed));
+}
+
+TEST(gzip, DecompressBuffer)
+{
+    std::string text;
+    for(int n = 0; n < 20000; n++) text += static_cast<char>('a' + n * n % 7);
+    const auto compressed = CompressToVector(text);
+
+    // ISIZE sizes the output exactly
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_gzip::Result::OK, mini_gzip::DecompressBuffer(compressed, output));
+    EXPECT_EQ(text, std::string(output.begin(), output.end()));
+    EXPECT_EQ(text.size(), output.capacity());
+
+    // An implausible ISIZE does not cause a huge allocation
+    auto inflated = compressed;
+    std::fill(inflated.end() - 4, inflated.end(), 0xff);
+    output = {};
+    EXPECT_EQ(mini_gzip::Result::SizeError, mini_gzip::DecompressBuffer(inflated, output));
+    EXPECT_LE(output.capacity(), compressed.size() * mini_gzip::constants::maximumExpansion);
+}
+
+TEST(gzip, CompressParallel)
+{
+    std::string text;
+    for(int n = 0; text.size() < 300000; n++)
+        text += "record " + std::to_string(n * 7919 % 1000) + " of the parallel gzip test\n";
+    for(const unsigned int num_threads: { 1, 4 }) {
+        std::vector<uint8_t> compressed;
+        EXPECT_EQ(mini_gzip::Result::OK, mini_gzip::CompressParallel(text, [&](const auto& v) {
+            compressed.insert(compressed.end(), v.begin(), v.end());
+        }, {}, {}, num_threads));
+        EXPECT_EQ(std::make_pair(mini_gzip::Result::OK, text), Decompress(compressed));
+    }
+}
@@ -19,6 +19,43 @@ namespace
         }
     }
 
+    void AppendChunk(std::vector<uint8_t>& png, const std::string& type, const std::vector<uint8_t>& data)
+    {
+        auto append32 = [&](uint32_t v) {
+            for(int shift = 24; shift >= 0; shift -= 8) png.push_back(static_cast<uint8_t>(v >> shift));
+        };
+        append32(static_cast<uint32_t>(data.size()));
+        const auto start = png.size();
+        png.insert(png.end(), type.begin(), type.end());
+        png.insert(png.end(), data.begin(), data.end());
+        mini_crc32::CRC32 crc;
+        crc.Update(png.begin() + start, png.end());
+        append32(*crc);
+    }
+
+    // A 4x2 greyscale image with a tEXt chunk after the image data
+    std::vector<uint8_t> MakePNG()
+    {
+        std::vector<uint8_t> png(mini_png::field::constants::png_signature.begin(), mini_png::field::constants::png_signature.end());
+        AppendChunk(png, "IHDR", { 0, 0, 0, 4, 0, 0, 0, 2, 8, 0, 0, 0, 0 });
+        const std::vector<uint8_t> scanlines{ 0, 1, 2, 3, 4, 0, 5, 6, 7, 8 };
+        std::vector<uint8_t> idat;
+        mini_zlib::Compress(scanlines, [&](const auto& v) { idat.insert(idat.end(), v.begin(), v.end()); });
+        AppendChunk(png, "IDAT", idat);
+        // Keyword, null separator and text
+        const std::string text{"Comment\0mini-png", 16};
+        AppendChunk(png, "tEXt", std::vector<uint8_t>(text.begin(), text.end()));
+        AppendChunk(png, "IEND", {});
+        return png;
+    }
+
+    mini_png::Result ParseWithPolicy(const std::vector<uint8_t>& png, mini_png::ChecksumPolicy policy, std::vector<uint8_t>* pixels = nullptr)
+    {
+        mini_png::ByteStreamer bs(png);
+        return mini_png::Parse(bs, [](const mini_png::ImageHeader&) { }, [&](const auto& scanline) {
+            if (pixels != nullptr) pixels->insert(pixels->end(), scanline.begin(), scanline.end());
+        }, policy);
+    }
 }
 
 TEST(ChunkType, PropertyBits)
@@ -35,6 +72,64 @@ TEST(ChunkType, PropertyBits)
     EXPECT_TRUE(type_bLOb.IsAncillary());
 }
 
+TEST(ImageHeader, CompressOptions)
+{
+    mini_png::ImageHeader ihdr{};
+    ihdr.width = 10;
+    ihdr.height = 4;
+    ihdr.bitDepth = 8;
+    ihdr.colorType = 2;
+    const auto options = ihdr.GetCompressOptions();
+    EXPECT_EQ(mini_deflate::Strategy::Rows, options.strategy);
+    EXPECT_EQ(31, options.row_stride);
+    EXPECT_EQ(3, options.pixel_stride);
+}
+
+TEST(png, ChunkChecksums)
+{
+    using mini_png::ChecksumPolicy;
+    using mini_png::Result;
+    const auto png = MakePNG();
+    std::vector<uint8_t> pixels;
+    EXPECT_EQ(Result::OK, ParseWithPolicy(png, ChecksumPolicy::All, &pixels));
+    EXPECT_EQ((std::vector<uint8_t>{ 1, 2, 3, 4, 5, 6, 7, 8 }), pixels);
+
+    auto findChunk = [&](const std::string& type) {
+        return std::search(png.begin(), png.end(), type.begin(), type.end()) - png.begin();
+    };
+    // Flips a bit in the chunk's CRC or data
+    auto corrupt = [&](std::size_t offset) {
+        auto copy = png;
+        copy[offset] ^= 0x10;
+        return copy;
+    };
+
+    const auto ihdr_crc = corrupt(findChunk("IHDR") + 4 + 13);
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(ihdr_crc, ChecksumPolicy::All));
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(ihdr_crc, ChecksumPolicy::CriticalOnly));
+    EXPECT_EQ(Result::OK, ParseWithPolicy(ihdr_crc, ChecksumPolicy::None));
+
+    const auto iend_crc = corrupt(findChunk("IEND") + 4);
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(iend_crc, ChecksumPolicy::CriticalOnly));
+    EXPECT_EQ(Result::OK, ParseWithPolicy(iend_crc, ChecksumPolicy::None));
+
+    const auto text_data = corrupt(findChunk("tEXt") + 4);
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(text_data, ChecksumPolicy::All));
+    EXPECT_EQ(Result::OK, ParseWithPolicy(text_data, ChecksumPolicy::CriticalOnly));
+    // The text following the keyword's null separator is covered as well
+    const auto text_value = corrupt(findChunk("tEXt") + 4 + 8);
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(text_value, ChecksumPolicy::All));
+    EXPECT_EQ(Result::OK, ParseWithPolicy(text_value, ChecksumPolicy::CriticalOnly));
+
+    // The zlib stream is intact, so only the chunk CRC can catch this; it
+    // directly precedes the length and type of the next chunk
+    const auto idat_crc = corrupt(findChunk("tEXt") - 8);
+    EXPECT_EQ(Result::ChecksumError, ParseWithPolicy(idat_crc, ChecksumPolicy::CriticalOnly));
+    EXPECT_EQ(Result::OK, ParseWithPolicy(idat_crc, ChecksumPolicy::None));
+
+    EXPECT_EQ(Result::PrematureEndOfFile, ParseWithPolicy(std::vector<uint8_t>(png.begin(), png.end() - 2), ChecksumPolicy::All));
+}
+
 TEST(png, png)
 {
     constexpr std::array<uint8_t, 258> image{
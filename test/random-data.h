@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Linear congruential generator, so that generated test data is the same on
+// every run
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : seed(seed) { }
+
+    // 15 random bits
+    uint32_t operator()()
+    {
+        Advance();
+        return (seed >> 16) & 0x7fff;
+    }
+
+    uint8_t Byte()
+    {
+        Advance();
+        return static_cast<uint8_t>(seed >> 24);
+    }
+
+private:
+    void Advance()
+    {
+        seed = seed * 1103515245 + 12345;
+    }
+
+    uint32_t seed;
+};
+
+// Uniformly distributed bytes, which deflate cannot compress
+inline std::vector<uint8_t> MakeRandomData(std::size_t size, uint32_t seed)
+{
+    Random random{seed};
+    std::vector<uint8_t> data(size);
+    for(auto& d: data) d = random.Byte();
+    return data;
+}
@@ -64,3 +64,242 @@ TEST(zlib, Content_HelloWorld)
     const std::vector<uint8_t> expected_output{ 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd' };
     VerifyDecompress(data, expected_output);
 }
+
+TEST(zlib, InvalidWindowSize)
+{
+    // CINFO 8 would be a 64 KiB window
+    constexpr std::array<uint8_t, 2> data{ 0x88, 0x1c };
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_zlib::Result::InvalidWindowSize, DecompressInto(data, output));
+}
+
+TEST(zlib, Compress)
+{
+    const std::string text{"hello world, hello world, hello zlib"};
+    const std::vector<uint8_t> expected(text.begin(), text.end());
+    for(int window_bits = 9; window_bits <= 15; window_bits++) {
+        for(const int level: { 0, 1, 6, 9 }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.window_bits = window_bits;
+            std::vector<uint8_t> compressed;
+            EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::Compress(text, [&](const auto& v) {
+                compressed.insert(compressed.end(), v.begin(), v.end());
+            }, options));
+            ASSERT_GE(compressed.size(), 6);
+            EXPECT_EQ(window_bits - 8, compressed[0] >> 4);
+            VerifyDecompress(compressed, expected);
+        }
+    }
+
+    // Headers as zlib itself writes them
+    const std::vector<std::pair<int, uint8_t>> flags{ { 1, 0x01 }, { 5, 0x5e }, { 6, 0x9c }, { 9, 0xda } };
+    for(const auto& [level, flg]: flags) {
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        std::vector<uint8_t> compressed;
+        mini_zlib::Compress(text, [&](const auto& v) { compressed.insert(compressed.end(), v.begin(), v.end()); }, options);
+        EXPECT_EQ(0x78, compressed[0]);
+        EXPECT_EQ(flg, compressed[1]);
+    }
+
+    mini_deflate::CompressOptions options;
+    options.window_bits = 16;
+    EXPECT_EQ(mini_zlib::Result::InvalidOptions, mini_zlib::Compress(text, [](const auto&) { }, options));
+}
+
+TEST(zlib, Content_Dictionary)
+{
+    // Compressed by zlib with a preset dictionary
+    constexpr std::array<uint8_t, 23> data{
+        0x78, 0xf9, 0x5c, 0x95, 0x06, 0xd3, 0xab, 0x86, 0x8b, 0xe7, 0x66, 0xe6,
+        0x65, 0xc2, 0x85, 0x4d, 0x8c, 0x6a, 0x01, 0x68, 0x3d, 0x07, 0x46
+    };
+    const std::string dictionary{ R"({"name": "value", "id": )" };
+    const std::string expected{ R"({"name": "mini", "id": 42})" };
+
+    std::vector<uint8_t> output;
+    EXPECT_EQ(mini_zlib::Result::UnknownDictionary, DecompressInto(data, output));
+
+    MemoryStreamer s{data};
+    mini_adler32::Value requested_id = 0;
+    const auto result = mini_zlib::Decompress(s, data.size(), [&](const auto& v) {
+        std::copy(v.begin(), v.end(), std::back_inserter(output));
+    }, [&](mini_adler32::Value id) {
+        requested_id = id;
+        return &dictionary;
+    });
+    EXPECT_EQ(mini_zlib::Result::OK, result);
+    EXPECT_EQ(0x5c9506d3, requested_id);
+    EXPECT_EQ(expected, std::string(output.begin(), output.end()));
+}
+
+TEST(zlib, CompressWithDictionary)
+{
+    const std::string dictionary{ R"({"user": "", "action": "login", "status": "ok", "timestamp": 16000})" };
+    const std::string record{ R"({"user": "alice", "action": "login", "status": "ok", "timestamp": 1600012345})" };
+
+    std::vector<uint8_t> plain, primed;
+    EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::Compress(record, [&](const auto& v) { plain.insert(plain.end(), v.begin(), v.end()); }));
+    EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::CompressWithDictionary(record, dictionary, [&](const auto& v) { primed.insert(primed.end(), v.begin(), v.end()); }));
+    EXPECT_LT(primed.size() * 2, plain.size());
+    EXPECT_NE(0, primed[1] & mini_zlib::constants::flag_FDICT);
+
+    auto decompress = [&](const std::string* known) {
+        std::vector<uint8_t> output;
+        MemoryStreamer s{primed};
+        const auto result = mini_zlib::Decompress(s, primed.size(), [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }, [&](mini_adler32::Value id) -> const std::string* {
+            mini_adler32::Adler32 adler;
+            adler.Update(known->begin(), known->end());
+            return *adler == id ? known : nullptr;
+        });
+        return std::make_pair(result, std::string(output.begin(), output.end()));
+    };
+    EXPECT_EQ(std::make_pair(mini_zlib::Result::OK, record), decompress(&dictionary));
+    const std::string other{ "something else" };
+    EXPECT_EQ(mini_zlib::Result::UnknownDictionary, decompress(&other).first);
+}
+
+TEST(zlib, CompressWithDictionaryStrategies)
+{
+    const std::string dictionary{ R"({"user": "", "action": "login", "status": "ok", "timestamp": 16000})" };
+    const std::string record{ R"({"user": "alice", "action": "login", "status": "ok", "timestamp": 1600012345})" };
+    for(const auto strategy: { mini_deflate::Strategy::Default, mini_deflate::Strategy::Fastest, mini_deflate::Strategy::Filtered,
+                               mini_deflate::Strategy::Rle, mini_deflate::Strategy::HuffmanOnly, mini_deflate::Strategy::Rows }) {
+        for(const int level: { mini_deflate::constants::level_Store, mini_deflate::constants::level_Default }) {
+            mini_deflate::CompressOptions options;
+            options.level = level;
+            options.strategy = strategy;
+            std::vector<uint8_t> compressed;
+            EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::CompressWithDictionary(record, dictionary, [&](const auto& v) {
+                compressed.insert(compressed.end(), v.begin(), v.end());
+            }, options));
+
+            std::vector<uint8_t> output;
+            MemoryStreamer s{compressed};
+            EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::Decompress(s, compressed.size(), [&](const auto& v) {
+                std::copy(v.begin(), v.end(), std::back_inserter(output));
+            }, [&](mini_adler32::Value) { return &dictionary; }));
+            EXPECT_EQ(record, std::string(output.begin(), output.end()));
+        }
+    }
+}
+
+TEST(zlib, CompressParallel)
+{
+    std::string text;
+    for(int n = 0; text.size() < 300000; n++)
+        text += "line " + std::to_string(n * 7919 % 1000) + " of the parallel zlib test\n";
+    const std::vector<uint8_t> expected(text.begin(), text.end());
+    for(const unsigned int num_threads: { 1, 3, 8 }) {
+        std::vector<uint8_t> compressed;
+        EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::CompressParallel(text, [&](const auto& v) {
+            compressed.insert(compressed.end(), v.begin(), v.end());
+        }, {}, num_threads));
+        VerifyDecompress(compressed, expected);
+    }
+}
+
+TEST(zlib, ChecksumPolicy)
+{
+    const std::string text{"hello world, hello world, hello zlib"};
+    std::vector<uint8_t> compressed;
+    mini_zlib::Compress(text, [&](const auto& v) { compressed.insert(compressed.end(), v.begin(), v.end()); });
+    mini_adler32::Adler32 adler;
+    adler.Update(text.begin(), text.end());
+
+    auto decompress = [](const std::vector<uint8_t>& data, mini_zlib::ChecksumPolicy policy, mini_zlib::Checksums& checksums) {
+        std::vector<uint8_t> output;
+        MemoryStreamer s{data};
+        const auto result = mini_zlib::Decompress(s, data.size(), [&](const auto& v) {
+            std::copy(v.begin(), v.end(), std::back_inserter(output));
+        }, mini_zlib::noDictionary, policy, &checksums);
+        return std::make_pair(result, std::string(output.begin(), output.end()));
+    };
+
+    auto corrupt = compressed;
+    corrupt.back() ^= 1;
+    const auto expected = std::make_pair(mini_zlib::Result::OK, text);
+    for(const auto policy: { mini_zlib::ChecksumPolicy::Verify, mini_zlib::ChecksumPolicy::Skip, mini_zlib::ChecksumPolicy::Defer }) {
+        mini_zlib::Checksums checksums;
+        EXPECT_EQ(expected, decompress(compressed, policy, checksums));
+        EXPECT_EQ(*adler, checksums.stored);
+        EXPECT_EQ(policy != mini_zlib::ChecksumPolicy::Skip, checksums.Matches());
+
+        const auto result = decompress(corrupt, policy, checksums).first;
+        EXPECT_EQ(*adler ^ 1, checksums.stored);
+        if (policy == mini_zlib::ChecksumPolicy::Verify) {
+            EXPECT_EQ(mini_zlib::Result::ChecksumError, result);
+        } else {
+            EXPECT_EQ(mini_zlib::Result::OK, result);
+            EXPECT_EQ(policy == mini_zlib::ChecksumPolicy::Skip, !checksums.computed.has_value());
+            EXPECT_FALSE(checksums.Matches());
+        }
+    }
+
+    // Invalid deflate data is reported as such, regardless of the policy
+    auto invalid = compressed;
+    invalid[2] = 0xff; // final block, reserved block type
+    mini_zlib::Checksums checksums;
+    EXPECT_EQ(mini_zlib::Result::DeflateError, decompress(invalid, mini_zlib::ChecksumPolicy::Skip, checksums).first);
+}
+
+TEST(zlib, StreamedInput)
+{
+    // Two streams back to back; each must be read up to its own end only
+    std::vector<uint8_t> input;
+    std::vector<std::size_t> lengths;
+    std::vector<std::string> texts;
+    for(const int level: { 0, 6 }) {
+        std::string text;
+        for(int n = 0; n < 2000; n++) text += std::to_string(n * level) + ",";
+        mini_deflate::CompressOptions options;
+        options.level = level;
+        const auto start = input.size();
+        mini_zlib::Compress(text, [&](const auto& v) { input.insert(input.end(), v.begin(), v.end()); }, options);
+        lengths.push_back(input.size() - start);
+        texts.push_back(text);
+    }
+
+    // Without GetBuffer(), the deflate data is pulled from the streamer;
+    // with it, it is decoded in place
+    struct BufferStreamer : MemoryStreamer<std::vector<uint8_t>>
+    {
+        using MemoryStreamer::MemoryStreamer;
+
+        const uint8_t* GetBuffer(std::size_t length)
+        {
+            if (data.size() - pos < length) return nullptr;
+            buffers++;
+            pos += length;
+            return data.data() + pos - length;
+        }
+
+        int buffers = 0;
+    };
+    static_assert(!mini_zlib::detail::HasGetBuffer<MemoryStreamer<std::vector<uint8_t>>>::value);
+    static_assert(mini_zlib::detail::HasGetBuffer<BufferStreamer>::value);
+
+    auto decode = [&](auto& s) {
+        for(std::size_t n = 0; n < texts.size(); n++) {
+            std::string output;
+            EXPECT_EQ(mini_zlib::Result::OK, mini_zlib::Decompress(s, lengths[n], [&](const auto& v) {
+                output.insert(output.end(), v.begin(), v.end());
+            }));
+            EXPECT_EQ(texts[n], output);
+        }
+        EXPECT_EQ(input.size(), s.pos);
+    };
+    MemoryStreamer streamer{input};
+    decode(streamer);
+    BufferStreamer buffered{input};
+    decode(buffered);
+    EXPECT_EQ(2, buffered.buffers);
+
+    // Input ending before the length given
+    const std::vector<uint8_t> truncated(input.begin(), input.begin() + lengths[0] / 2);
+    MemoryStreamer s{truncated};
+    EXPECT_EQ(mini_zlib::Result::PrematureEndOfStream, mini_zlib::Decompress(s, lengths[0], [](const auto&) { }));
+}